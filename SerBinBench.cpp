@@ -0,0 +1,986 @@
+// Speed-of-light benchmark: every SerBin backend and encoding is timed next to
+// the theoretical ceiling for the same bytes, and reported as percent-of-peak.
+//
+// Usage: SerBinBench [--perf] [--sweep] [directory] [megabytes]
+// POSIX only (raw write/read and mmap ceilings). With --perf, SerBin rows also
+// report hardware counters per byte and per element (Linux perf_event_open).
+// With --sweep, file backends are instead run over a grid of buffer size,
+// queue depth, direct I/O and sync policy, and the best configuration per sync
+// policy is written to serbin_sweep.conf.
+#include "serbin.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+using namespace serbin;
+using namespace std;
+
+namespace
+{
+    constexpr int repetitions = 5;
+
+    // Scans store their result here so the loads are not optimized away
+    volatile uint64_t scanSink = 0;
+
+    // std::filebuf's default buffer, so raw syscalls move the same chunk sizes
+    constexpr size_t ioChunk = BUFSIZ;
+
+    struct Dataset
+    {
+        string name;
+        size_t elements;
+        function<void(SerBin<ios::out>&)> write;
+        function<void(SerBin<ios::in>&)> read;
+    };
+
+    //////////////////////////////////////////////////////////////////////////////////
+    // Hardware counters
+    //////////////////////////////////////////////////////////////////////////////////
+#if defined(__linux__)
+    constexpr uint64_t cacheReadMiss(uint64_t cache)
+    {
+        return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    }
+#endif
+
+    class PerfCounters
+    {
+    public:
+        struct Event
+        {
+            const char* name;
+            uint32_t type;
+            uint64_t config;
+        };
+
+#if defined(__linux__)
+        static constexpr Event events[] =
+        {
+            { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+            { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+            { "branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+            { "L1d-misses", PERF_TYPE_HW_CACHE, cacheReadMiss(PERF_COUNT_HW_CACHE_L1D) },
+            { "LLC-misses", PERF_TYPE_HW_CACHE, cacheReadMiss(PERF_COUNT_HW_CACHE_LL) },
+            { "dTLB-misses", PERF_TYPE_HW_CACHE, cacheReadMiss(PERF_COUNT_HW_CACHE_DTLB) },
+        };
+#else
+        static constexpr Event events[] = { { "unsupported", 0, 0 } };
+#endif
+        static constexpr size_t count = size(events);
+
+        PerfCounters()
+        {
+            fds.fill(-1);
+            values.fill(0);
+            coverage.fill(0);
+        }
+
+        ~PerfCounters()
+        {
+            for (int fd : fds)
+            {
+                if (fd >= 0)
+                    close(fd);
+            }
+        }
+
+        // Opens whatever the kernel allows; false if nothing could be opened
+        bool open()
+        {
+            bool any = false;
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                fds[i] = openEvent(events[i], false);
+                if (fds[i] < 0)
+                    fds[i] = openEvent(events[i], true);
+
+                any |= fds[i] >= 0;
+            }
+
+            return any;
+        }
+
+        void start()
+        {
+#if defined(__linux__)
+            for (int fd : fds)
+            {
+                if (fd < 0)
+                    continue;
+
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+#endif
+        }
+
+        void stop(int runs)
+        {
+#if defined(__linux__)
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (fds[i] < 0)
+                    continue;
+
+                ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+                // value, time enabled, time running: when the PMU multiplexes
+                // more events than it has counters, each counts part of the time
+                uint64_t sample[3] = {};
+                if (read(fds[i], sample, sizeof(sample)) != sizeof(sample) || sample[1] == 0 || sample[2] == 0)
+                {
+                    values[i] = 0;
+                    coverage[i] = 0;
+                    continue;
+                }
+
+                coverage[i] = double(sample[2]) / double(sample[1]);
+                values[i] = double(sample[0]) / coverage[i] / runs;
+            }
+#endif
+        }
+
+        void report(size_t bytes, size_t elements) const
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (fds[i] < 0)
+                    continue;
+
+                if (coverage[i] == 0)
+                    printf("      %-14s %12s\n", events[i].name, "not scheduled, no count");
+                else if (coverage[i] < 1)
+                    printf("      %-14s %12.4f /byte %12.2f /element  (scaled from %.0f%% of the time)\n", events[i].name, values[i] / bytes, values[i] / elements, 100 * coverage[i]);
+                else
+                    printf("      %-14s %12.4f /byte %12.2f /element\n", events[i].name, values[i] / bytes, values[i] / elements);
+            }
+        }
+
+    private:
+        static int openEvent(const Event& event, bool userOnly)
+        {
+#if defined(__linux__)
+            perf_event_attr attr = {};
+            attr.size = sizeof(attr);
+            attr.type = event.type;
+            attr.config = event.config;
+            attr.disabled = 1;
+            attr.exclude_kernel = userOnly;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+            return int(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+#else
+            (void)event;
+            (void)userOnly;
+            return -1;
+#endif
+        }
+
+        array<int, count> fds;
+        array<double, count> values;
+        array<double, count> coverage; // fraction of the enabled time each was counting
+    };
+
+    // Set by --perf; counters cover the runs of the latest measure()
+    PerfCounters* counters = nullptr;
+
+    // Best wall time of several runs, in seconds
+    double measure(const function<void()>& body)
+    {
+        double best = numeric_limits<double>::max();
+
+        if (counters)
+            counters->start();
+
+        for (int i = 0; i < repetitions; ++i)
+        {
+            auto start = chrono::steady_clock::now();
+            body();
+            chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+            best = min(best, elapsed.count());
+        }
+
+        if (counters)
+            counters->stop(repetitions);
+
+        return best;
+    }
+
+    size_t fileSize(const string& path)
+    {
+        struct stat info;
+        return stat(path.c_str(), &info) == 0 ? size_t(info.st_size) : 0;
+    }
+
+    double megabytesPerSecond(size_t bytes, double seconds)
+    {
+        return double(bytes) / (1024.0 * 1024.0) / seconds;
+    }
+
+    // Must directly follow the measure() of the row, so counters match it
+    void reportRow(const string& name, size_t bytes, size_t elements, double seconds)
+    {
+        printf("  %-34s %10.1f MB/s\n", name.c_str(), megabytesPerSecond(bytes, seconds));
+
+        if (counters)
+            counters->report(bytes, elements);
+    }
+
+    void reportCeiling(const string& name, size_t bytes, double seconds, double serbinSeconds)
+    {
+        printf("    vs %-31s %10.1f MB/s  %6.1f%% of peak\n", name.c_str(), megabytesPerSecond(bytes, seconds), 100.0 * seconds / serbinSeconds);
+    }
+
+    //////////////////////////////////////////////////////////////////////////////////
+    // Ceilings
+    //////////////////////////////////////////////////////////////////////////////////
+    double ceilingMemcpy(size_t bytes)
+    {
+        vector<char> source(bytes, 1), target(bytes);
+        return measure([&] { memcpy(target.data(), source.data(), bytes); });
+    }
+
+    double ceilingWrite(const string& path, size_t bytes)
+    {
+        vector<char> chunk(ioChunk, 1);
+
+        return measure([&]
+        {
+            int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            for (size_t done = 0; done < bytes; done += ioChunk)
+            {
+                if (write(fd, chunk.data(), min(ioChunk, bytes - done)) < 0)
+                    break;
+            }
+            close(fd);
+        });
+    }
+
+    double ceilingRead(const string& path)
+    {
+        vector<char> chunk(ioChunk);
+
+        return measure([&]
+        {
+            int fd = open(path.c_str(), O_RDONLY);
+            while (read(fd, chunk.data(), ioChunk) > 0)
+                ;
+            close(fd);
+        });
+    }
+
+    // Pages are populated up front, so the scan itself never faults
+    double ceilingMmapScan(const string& path, size_t bytes)
+    {
+        return measure([&]
+        {
+            int fd = open(path.c_str(), O_RDONLY);
+            void* mapped = mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+            close(fd);
+            if (mapped == MAP_FAILED)
+                return;
+
+            const unsigned long* words = (const unsigned long*)mapped;
+            unsigned long sum = 0;
+            for (size_t i = 0; i < bytes / sizeof(unsigned long); ++i)
+                sum += words[i];
+
+            scanSink = sum;
+            munmap(mapped, bytes);
+        });
+    }
+
+    //////////////////////////////////////////////////////////////////////////////////
+    // Datasets
+    //////////////////////////////////////////////////////////////////////////////////
+    template<typename T>
+    Dataset makeDataset(const string& name, shared_ptr<T> data, size_t elements)
+    {
+        return Dataset{ name, elements,
+            [data](SerBin<ios::out>& writer) { writer << *data; },
+            [](SerBin<ios::in>& reader) { T loaded; reader >> loaded; } };
+    }
+
+    template<Encoding E, typename T>
+    Dataset makeEncodedDataset(const string& name, shared_ptr<vector<T>> data)
+    {
+        return Dataset{ name, data->size(),
+            [data](SerBin<ios::out>& writer) { writer << encoded<E>(*data); },
+            [](SerBin<ios::in>& reader) { vector<T> loaded; reader >> encoded<E>(loaded); } };
+    }
+
+    // The whole container as one LZ message; Compression is per thread, and
+    // the benchmark runs on one
+    template<typename T>
+    Dataset makeCompressedDataset(const string& name, shared_ptr<T> data, size_t elements)
+    {
+        auto compression = make_shared<Compression>(make_shared<LZCodec>());
+        compression->limit(numeric_limits<size_t>::max());
+
+        return Dataset{ name, elements,
+            [data, compression](SerBin<ios::out>& writer) { writer << compressed(*data, *compression); },
+            [compression](SerBin<ios::in>& reader) { T loaded; reader >> compressed(loaded, *compression); } };
+    }
+
+    vector<Dataset> makeDatasets(size_t bytes)
+    {
+        vector<Dataset> datasets;
+
+        size_t count = bytes / sizeof(uint32_t);
+        auto integers = make_shared<vector<uint32_t>>(count);
+        for (size_t i = 0; i < count; ++i)
+            (*integers)[i] = uint32_t(i * 2654435761u);
+        datasets.push_back(makeDataset("vector<uint32_t> (POD bulk)", integers, count));
+
+        auto categories = make_shared<vector<uint32_t>>(count);
+        for (size_t i = 0; i < count; ++i)
+            (*categories)[i] = i % 97 == 0 ? uint32_t(i) : uint32_t(i * 2654435761u) % 300;
+        datasets.push_back(makeEncodedDataset<Encoding::BitPacked>("vector<uint32_t> small values, BitPacked", categories));
+        datasets.push_back(makeEncodedDataset<Encoding::Adaptive>("vector<uint32_t> small values, Adaptive", categories));
+
+        auto timestamps = make_shared<vector<uint32_t>>(count);
+        for (size_t i = 0; i < count; ++i)
+            (*timestamps)[i] = uint32_t(i * 3 + i * 2654435761u % 3);
+        datasets.push_back(makeEncodedDataset<Encoding::Delta>("vector<uint32_t> ascending, Delta", timestamps));
+
+        auto states = make_shared<vector<uint32_t>>(count);
+        for (size_t i = 0; i < count; ++i)
+            (*states)[i] = uint32_t(i / 1000 % 5);
+        datasets.push_back(makeEncodedDataset<Encoding::RunLength>("vector<uint32_t> runs, RunLength", states));
+
+        count = bytes / sizeof(float);
+        auto embedding = make_shared<vector<float>>(count);
+        for (size_t i = 0; i < count; ++i)
+            (*embedding)[i] = sin(float(i)) * 3.f;
+        datasets.push_back(makeEncodedDataset<Encoding::Float16>("vector<float>, Float16", embedding));
+        datasets.push_back(makeEncodedDataset<Encoding::BFloat16>("vector<float>, BFloat16", embedding));
+        datasets.push_back(makeEncodedDataset<Encoding::QuantizedInt8>("vector<float>, QuantizedInt8", embedding));
+
+        count = bytes / (sizeof(uint32_t) + sizeof(float));
+        auto pairs = make_shared<vector<pair<uint32_t, float>>>(count);
+        for (size_t i = 0; i < count; ++i)
+            (*pairs)[i] = { uint32_t(i), float(i) * 0.5f };
+        datasets.push_back(makeDataset("vector<pair<uint32_t, float>>", pairs, count));
+
+        count = bytes / (sizeof(size_t) + 24);
+        auto strings = make_shared<vector<string>>(count);
+        for (size_t i = 0; i < count; ++i)
+            (*strings)[i] = "/data/tenant/" + to_string(i) + "/blob";
+        datasets.push_back(makeDataset("vector<string>", strings, count));
+        datasets.push_back(makeCompressedDataset("vector<string>, LZ compressed", strings, count));
+
+        count = bytes / (sizeof(uint32_t) * 2);
+        auto table = make_shared<unordered_map<uint32_t, uint32_t>>();
+        table->reserve(count);
+        for (size_t i = 0; i < count; ++i)
+            table->emplace(uint32_t(i), uint32_t(i * 7));
+        datasets.push_back(makeDataset("unordered_map<uint32_t, uint32_t>", table, count));
+
+        return datasets;
+    }
+
+    //////////////////////////////////////////////////////////////////////////////////
+    // Backends
+    //////////////////////////////////////////////////////////////////////////////////
+    void benchFile(const Dataset& dataset, const string& path)
+    {
+        double writeSeconds = measure([&]
+        {
+            SerBin<ios::out> writer(path);
+            dataset.write(writer);
+        });
+
+        size_t bytes = fileSize(path);
+        reportRow("fstream write", bytes, dataset.elements, writeSeconds);
+        reportCeiling("write(2)", bytes, ceilingWrite(path + ".raw", bytes), writeSeconds);
+        reportCeiling("memcpy", bytes, ceilingMemcpy(bytes), writeSeconds);
+
+        double readSeconds = measure([&]
+        {
+            SerBin<ios::in> reader(path);
+            dataset.read(reader);
+        });
+
+        reportRow("fstream read", bytes, dataset.elements, readSeconds);
+        double readCeiling = ceilingRead(path);
+        double mmapCeiling = ceilingMmapScan(path, bytes);
+        reportCeiling("read(2)", bytes, readCeiling, readSeconds);
+        reportCeiling("mmap scan", bytes, mmapCeiling, readSeconds);
+
+        double cursorSeconds = measure([&]
+        {
+            SharedFile file(path);
+            SharedFile::Cursor cursor(file);
+            dataset.read(cursor);
+        });
+
+        reportRow("SharedFile cursor read", bytes, dataset.elements, cursorSeconds);
+        reportCeiling("read(2)", bytes, readCeiling, cursorSeconds);
+        reportCeiling("mmap scan", bytes, mmapCeiling, cursorSeconds);
+
+        unlink((path + ".raw").c_str());
+        unlink(path.c_str());
+    }
+
+    void benchMemory(const Dataset& dataset)
+    {
+        stringbuf memory;
+
+        double writeSeconds = measure([&]
+        {
+            memory.str({});
+            SerBin<ios::out> writer(memory);
+            dataset.write(writer);
+        });
+
+        size_t bytes = memory.str().size();
+        reportRow("stringbuf write", bytes, dataset.elements, writeSeconds);
+
+        stringbuf source(memory.str());
+        double copyCeiling = ceilingMemcpy(bytes);
+        reportCeiling("memcpy", bytes, copyCeiling, writeSeconds);
+
+        double readSeconds = measure([&]
+        {
+            source.pubseekpos(0);
+            SerBin<ios::in> reader(source);
+            dataset.read(reader);
+        });
+
+        reportRow("stringbuf read", bytes, dataset.elements, readSeconds);
+        reportCeiling("memcpy", bytes, copyCeiling, readSeconds);
+
+        // Same bytes through a caller-owned fixed buffer: no growth, no copies out
+        vector<char> slot(bytes);
+        double fixedWriteSeconds = measure([&]
+        {
+            FixedWriter writer(slot.data(), slot.size());
+            dataset.write(writer);
+        });
+
+        reportRow("fixed write", bytes, dataset.elements, fixedWriteSeconds);
+        reportCeiling("memcpy", bytes, copyCeiling, fixedWriteSeconds);
+
+        double fixedReadSeconds = measure([&]
+        {
+            FixedReader reader(slot.data(), slot.size());
+            dataset.read(reader);
+        });
+
+        reportRow("fixed read", bytes, dataset.elements, fixedReadSeconds);
+        reportCeiling("memcpy", bytes, copyCeiling, fixedReadSeconds);
+
+        // Hashing the encoding as it is produced, against hashing it in memory
+        double hashSeconds = measure([&]
+        {
+            HashWriter writer;
+            dataset.write(writer);
+            scanSink = writer.digest();
+        });
+
+        reportRow("hash sink", bytes, dataset.elements, hashSeconds);
+
+        string encoded = memory.str();
+        double hashCeiling = measure([&] { scanSink = detail::xxhash64(encoded.data(), encoded.size()); });
+        reportCeiling("xxhash64", bytes, hashCeiling, hashSeconds);
+    }
+
+    // The same encoding through the integrity and fan-out sinks
+    void benchSinks(const Dataset& dataset, const string& path)
+    {
+        double merkleWriteSeconds = measure([&]
+        {
+            MerkleWriter writer(path);
+            dataset.write(writer);
+            writer.finish();
+        });
+
+        size_t bytes = fileSize(path);
+        reportRow("Merkle write", bytes, dataset.elements, merkleWriteSeconds);
+        reportCeiling("write(2)", bytes, ceilingWrite(path + ".raw", bytes), merkleWriteSeconds);
+
+        double merkleReadSeconds = measure([&]
+        {
+            MerkleFile file(path);
+            MerkleFile::Cursor cursor(file);
+            dataset.read(cursor);
+        });
+
+        reportRow("Merkle cursor read", bytes, dataset.elements, merkleReadSeconds);
+        double readCeiling = ceilingRead(path);
+        reportCeiling("read(2)", bytes, readCeiling, merkleReadSeconds);
+
+        double verifySeconds = measure([&]
+        {
+            MerkleFile file(path);
+            scanSink = file.verify();
+        });
+
+        reportRow("Merkle verify", bytes, dataset.elements, verifySeconds);
+        reportCeiling("read(2)", bytes, readCeiling, verifySeconds);
+
+        // One encode, two files: rated on the bytes reaching both
+        double teeSeconds = measure([&]
+        {
+            filebuf first, second;
+            first.open(path + ".tee0", ios::out | ios::trunc | ios::binary);
+            second.open(path + ".tee1", ios::out | ios::trunc | ios::binary);
+            TeeWriter writer({ &first, &second });
+            dataset.write(writer);
+            writer.finish();
+        });
+
+        size_t teeBytes = 2 * fileSize(path + ".tee0");
+        reportRow("tee write, 2 files", teeBytes, dataset.elements, teeSeconds);
+        reportCeiling("write(2)", teeBytes, ceilingWrite(path + ".raw", teeBytes), teeSeconds);
+
+        for (const char* suffix : { "", ".raw", ".tee0", ".tee1" })
+            unlink((path + suffix).c_str());
+    }
+
+    // Per-file setup: a fresh SerBin per file against one reopened across them
+    void benchSmallFiles(const string& directory)
+    {
+        constexpr size_t files = 2000, bufferSize = 64 << 10;
+        array<uint64_t, 25> payload{};
+        vector<string> names;
+        for (size_t i = 0; i < files; ++i)
+            names.push_back(directory + "/serbin_small_" + to_string(i) + ".bin");
+
+        size_t bytes = files * sizeof(payload);
+        printf("\n%zu files of %zu bytes\n", files, sizeof(payload));
+
+        // Both sides then truncate existing files rather than create them, and
+        // start without a backlog of dirty pages from the other
+        for (auto&& name : names)
+        {
+            SerBin<ios::out> writer(name);
+            writer << payload;
+        }
+
+        sync();
+
+        double freshSeconds = measure([&]
+        {
+            for (auto&& name : names)
+            {
+                SerBin<ios::out> writer(name, bufferSize);
+                writer << payload;
+            }
+        });
+
+        reportRow("SerBin per file", bytes, files, freshSeconds);
+        sync();
+
+        double reopenSeconds = measure([&]
+        {
+            SerBin<ios::out> writer(names[0], bufferSize);
+            for (auto&& name : names)
+            {
+                writer.open(name);
+                writer << payload;
+            }
+        });
+
+        reportRow("one SerBin, reopened", bytes, files, reopenSeconds);
+
+        for (auto&& name : names)
+            remove(name.c_str());
+    }
+
+    //////////////////////////////////////////////////////////////////////////////////
+    // I/O parameter sweep
+    //////////////////////////////////////////////////////////////////////////////////
+    enum class SyncPolicy
+    {
+        None,
+        AtClose,
+        Periodic
+    };
+
+    constexpr SyncPolicy syncPolicies[] = { SyncPolicy::None, SyncPolicy::AtClose, SyncPolicy::Periodic };
+    constexpr size_t sweepBufferSizes[] = { 4 << 10, 16 << 10, 64 << 10, 256 << 10, 1 << 20 };
+    constexpr int sweepQueueDepths[] = { 1, 2, 4, 8 };
+
+    // A record is written element-wise, the way SerBin callers usually write
+    constexpr size_t recordWords = 64;
+    constexpr size_t recordBytes = recordWords * sizeof(uint64_t);
+    constexpr size_t periodicSyncBytes = 8 << 20;
+    constexpr size_t directAlignment = 4096;
+
+    const char* syncName(SyncPolicy policy)
+    {
+        switch (policy)
+        {
+        case SyncPolicy::AtClose:
+            return "close";
+        case SyncPolicy::Periodic:
+            return "every-8MB";
+        default:
+            return "none";
+        }
+    }
+
+    struct SweepPoint
+    {
+        string backend;
+        size_t bufferSize;
+        int queueDepth;
+        bool direct;
+        SyncPolicy sync;
+        size_t bytes = 0; // actually written, then read back
+        double writeSeconds = 0;
+        double readSeconds = 0;
+        vector<double> latencies = {}; // per record written, microseconds
+    };
+
+    double secondsSince(chrono::steady_clock::time_point start)
+    {
+        return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+
+    double percentile(vector<double>& samples, double fraction)
+    {
+        if (samples.empty())
+            return 0;
+
+        size_t index = min(samples.size() - 1, size_t(fraction * samples.size()));
+        nth_element(samples.begin(), samples.begin() + index, samples.end());
+        return samples[index];
+    }
+
+    void syncFile(const string& path)
+    {
+        int fd = open(path.c_str(), O_WRONLY);
+        fsync(fd);
+        close(fd);
+    }
+
+    SweepPoint sweepFstream(const string& path, size_t bytes, size_t bufferSize, SyncPolicy sync)
+    {
+        SweepPoint point{ "fstream", bufferSize, 1, false, sync };
+        size_t records = bytes / recordBytes;
+        point.bytes = records * recordBytes;
+        point.latencies.reserve(records);
+
+        auto start = chrono::steady_clock::now();
+        {
+            SerBin<ios::out> writer(path, bufferSize);
+
+            for (size_t r = 0; r < records; ++r)
+            {
+                auto recordStart = chrono::steady_clock::now();
+
+                for (size_t w = 0; w < recordWords; ++w)
+                    writer << uint64_t(r * recordWords + w);
+
+                if (sync == SyncPolicy::Periodic && (r + 1) * recordBytes % periodicSyncBytes == 0)
+                {
+                    writer.stream.flush();
+                    syncFile(path);
+                }
+
+                point.latencies.push_back(secondsSince(recordStart) * 1e6);
+            }
+        }
+
+        if (sync != SyncPolicy::None)
+            syncFile(path);
+
+        point.writeSeconds = secondsSince(start);
+
+        start = chrono::steady_clock::now();
+        {
+            SerBin<ios::in> reader(path, bufferSize);
+            uint64_t value;
+
+            for (size_t i = 0; i < records * recordWords; ++i)
+                reader >> value;
+        }
+        point.readSeconds = secondsSince(start);
+
+        return point;
+    }
+
+    // The write(2) path a descriptor-based backend takes: queueDepth threads each
+    // own a region and keep one pwrite/pread of bufferSize in flight.
+    optional<SweepPoint> sweepRaw(const string& path, size_t bytes, size_t bufferSize, int queueDepth, bool direct, SyncPolicy sync)
+    {
+        SweepPoint point{ "raw", bufferSize, queueDepth, direct, sync };
+        size_t region = bytes / queueDepth / bufferSize * bufferSize;
+        if (region == 0)
+            return {};
+        point.bytes = region * queueDepth;
+
+#ifdef O_DIRECT
+        int flags = direct ? O_DIRECT : 0;
+#else
+        // macOS and the BSDs have no O_DIRECT; the sweep skips direct points
+        if (direct)
+            return {};
+        int flags = 0;
+#endif
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | flags, 0644);
+        if (fd < 0)
+            return {};
+
+        vector<vector<double>> latencies(queueDepth);
+        vector<thread> workers;
+        atomic<bool> failed = false;
+        vector<uint64_t> sums(queueDepth);
+
+        auto start = chrono::steady_clock::now();
+        for (int t = 0; t < queueDepth; ++t)
+        {
+            workers.emplace_back([&, t]
+            {
+                void* memory = nullptr;
+                if (posix_memalign(&memory, directAlignment, bufferSize) != 0)
+                {
+                    failed = true;
+                    return;
+                }
+
+                char* buffer = (char*)memory;
+                size_t filled = 0;
+                off_t offset = off_t(t * region);
+                latencies[t].reserve(region / recordBytes);
+
+                for (size_t r = 0; r < region / recordBytes; ++r)
+                {
+                    auto recordStart = chrono::steady_clock::now();
+
+                    for (size_t w = 0; w < recordWords; ++w)
+                    {
+                        uint64_t value = r * recordWords + w;
+                        memcpy(buffer + filled, &value, sizeof(value));
+                        filled += sizeof(value);
+
+                        if (filled < bufferSize)
+                            continue;
+
+                        if (pwrite(fd, buffer, bufferSize, offset) != ssize_t(bufferSize))
+                            failed = true;
+
+                        offset += off_t(bufferSize);
+                        filled = 0;
+
+                        if (sync == SyncPolicy::Periodic && (offset - off_t(t * region)) % off_t(periodicSyncBytes / queueDepth) < off_t(bufferSize))
+                            fdatasync(fd);
+                    }
+
+                    latencies[t].push_back(secondsSince(recordStart) * 1e6);
+                }
+
+                free(memory);
+            });
+        }
+
+        for (auto&& worker : workers)
+            worker.join();
+
+        if (sync != SyncPolicy::None)
+            fdatasync(fd);
+
+        close(fd);
+        point.writeSeconds = secondsSince(start);
+
+        if (failed)
+            return {};
+
+        for (auto&& samples : latencies)
+            point.latencies.insert(point.latencies.end(), samples.begin(), samples.end());
+
+        fd = open(path.c_str(), O_RDONLY | flags);
+        if (fd < 0)
+            return {};
+
+        workers.clear();
+        start = chrono::steady_clock::now();
+        for (int t = 0; t < queueDepth; ++t)
+        {
+            workers.emplace_back([&, t]
+            {
+                void* memory = nullptr;
+                if (posix_memalign(&memory, directAlignment, bufferSize) != 0)
+                {
+                    failed = true;
+                    return;
+                }
+
+                uint64_t sum = 0;
+
+                for (size_t done = 0; done < region; done += bufferSize)
+                {
+                    if (pread(fd, memory, bufferSize, off_t(t * region + done)) != ssize_t(bufferSize))
+                        failed = true;
+
+                    const uint64_t* words = (const uint64_t*)memory;
+                    for (size_t i = 0; i < bufferSize / sizeof(uint64_t); ++i)
+                        sum += words[i];
+                }
+
+                sums[t] = sum;
+                free(memory);
+            });
+        }
+
+        for (auto&& worker : workers)
+            worker.join();
+
+        close(fd);
+        point.readSeconds = secondsSince(start);
+        for (uint64_t sum : sums)
+            scanSink = scanSink + sum;
+
+        if (failed)
+            return {};
+
+        return point;
+    }
+
+    void reportSweepPoint(SweepPoint& point)
+    {
+        printf("  %-8s %8zu %3d %-8s %-10s %10.1f %10.1f %9.2f %9.2f\n", point.backend.c_str(), point.bufferSize, point.queueDepth,
+            point.direct ? "direct" : "buffered", syncName(point.sync), megabytesPerSecond(point.bytes, point.writeSeconds),
+            megabytesPerSecond(point.bytes, point.readSeconds), percentile(point.latencies, 0.5), percentile(point.latencies, 0.99));
+    }
+
+    // Best write-then-read round trip per byte moved for each backend and sync
+    // policy; sync is a durability requirement, not something to optimize away.
+    void writeRecommendation(const vector<SweepPoint>& points, const string& directory, size_t megabytes)
+    {
+        ofstream conf("serbin_sweep.conf");
+        conf << "# SerBin I/O sweep of " << directory << ", " << megabytes << " MB per point\n";
+        printf("\nRecommended (written to serbin_sweep.conf):\n");
+
+        for (const char* backend : { "fstream", "raw" })
+        {
+            for (SyncPolicy sync : syncPolicies)
+            {
+                const SweepPoint* best = nullptr;
+
+                for (auto&& point : points)
+                {
+                    if (point.backend != backend || point.sync != sync || point.bytes == 0)
+                        continue;
+
+                    double perByte = (point.writeSeconds + point.readSeconds) / double(point.bytes);
+                    if (!best || perByte < (best->writeSeconds + best->readSeconds) / double(best->bytes))
+                        best = &point;
+                }
+
+                if (!best)
+                    continue;
+
+                string prefix = string(backend) + "." + syncName(sync) + ".";
+                conf << prefix << "bufferSize=" << best->bufferSize << "\n";
+                conf << prefix << "queueDepth=" << best->queueDepth << "\n";
+                conf << prefix << "direct=" << best->direct << "\n";
+                printf("  %-8s sync=%-10s bufferSize=%zu queueDepth=%d %s\n", backend, syncName(sync), best->bufferSize, best->queueDepth,
+                    best->direct ? "direct" : "buffered");
+            }
+        }
+    }
+
+    void sweep(const string& directory, size_t megabytes)
+    {
+        string path = directory + "/serbin_sweep.bin";
+        size_t bytes = megabytes * 1024 * 1024;
+        vector<SweepPoint> points;
+
+        printf("SerBin I/O sweep, %zu MB per point, in %s\n\n", megabytes, directory.c_str());
+        printf("  %-8s %8s %3s %-8s %-10s %10s %10s %9s %9s\n", "backend", "buffer", "qd", "mode", "sync", "write MB/s", "read MB/s", "p50 us", "p99 us");
+
+        for (SyncPolicy sync : syncPolicies)
+        {
+            for (size_t bufferSize : sweepBufferSizes)
+            {
+                points.push_back(sweepFstream(path, bytes, bufferSize, sync));
+                reportSweepPoint(points.back());
+
+                for (int queueDepth : sweepQueueDepths)
+                {
+                    for (bool direct : { false, true })
+                    {
+                        if (auto point = sweepRaw(path, bytes, bufferSize, queueDepth, direct, sync))
+                        {
+                            points.push_back(std::move(*point));
+                            reportSweepPoint(points.back());
+                        }
+                        else if (direct && queueDepth == 1 && bufferSize == sweepBufferSizes[0] && sync == SyncPolicy::None)
+                        {
+                            printf("  raw      O_DIRECT unsupported here, skipping direct points\n");
+                        }
+                    }
+                }
+            }
+        }
+
+        unlink(path.c_str());
+        writeRecommendation(points, directory, megabytes);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    vector<string> positional;
+    PerfCounters perf;
+    bool sweepMode = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (string(argv[i]) == "--sweep")
+            sweepMode = true;
+        else if (string(argv[i]) != "--perf")
+            positional.push_back(argv[i]);
+        else if (perf.open())
+            counters = &perf;
+        else
+            printf("perf_event_open unavailable (check /proc/sys/kernel/perf_event_paranoid), counters disabled\n");
+    }
+
+    string directory = positional.size() > 0 ? positional[0] : ".";
+    size_t megabytes = positional.size() > 1 ? strtoull(positional[1].c_str(), nullptr, 10) : 64;
+    string path = directory + "/serbin_bench.bin";
+
+    if (sweepMode)
+    {
+        sweep(directory, megabytes);
+        return 0;
+    }
+
+    printf("SerBin speed-of-light, %zu MB per dataset, best of %d, in %s\n", megabytes, repetitions, directory.c_str());
+
+    for (auto&& dataset : makeDatasets(megabytes * 1024 * 1024))
+    {
+        printf("\n%s, %zu elements\n", dataset.name.c_str(), dataset.elements);
+        benchFile(dataset, path);
+        benchMemory(dataset);
+        benchSinks(dataset, path);
+    }
+
+    benchSmallFiles(directory);
+}
@@ -1,8 +1,45 @@
+#define SERBIN_INTERPOSE_ALLOCATOR
 #include "serbin.h"
 
+#include <cmath>
+#include <cstdio>
+#include <thread>
+
+struct Leaf
+{
+    double weight;
+};
+
+struct Node
+{
+    int value;
+    Node* children[2];
+    const Leaf* leaf;
+};
+
+namespace serbin
+{
+    template<>
+    constexpr Encoding encodeAs<uint16_t> = Encoding::BitPacked;
+
+    template<>
+    constexpr auto pointerMembers<Node> = std::tuple(&Node::children, &Node::leaf);
+}
+
 using namespace serbin;
 using namespace std;
 
+int failures = 0;
+
+void check(bool condition, const char* what)
+{
+    if (!condition)
+    {
+        printf("FAILED: %s\n", what);
+        ++failures;
+    }
+}
+
 class Custom
 {
     unique_ptr<tuple<float, double, long long>> data = make_unique<tuple<float, double, long long>>();
@@ -27,6 +64,9 @@ public:
     }
 };
 
+template<>
+constexpr auto serbin::schemaFields<Custom> = Fields<unique_ptr<tuple<float, double, long long>>>();
+
 int main()
 {
     string filename("test.txt");
@@ -60,5 +100,996 @@ int main()
         reader >> data1;
         reader >> data2;
         reader >> custom;
+
+        check(data0 == vector<optional<int>>{ {}, 456, 7890 }, "vector<optional<int>> round trip");
+        check(data1.size() == 3 && data1["Borealis"] == false, "map<string, bool> round trip");
+        check(data2.count(L"Elemental") == 1, "unordered_set<wstring> round trip");
+    }
+
+    // Vectors of pairs/tuples of PODs take the packed-record bulk path
+    {
+        vector<pair<uint32_t, float>> edges(10000);
+        vector<tuple<uint8_t, double, int16_t>> records(3000);
+        for (size_t i = 0; i < edges.size(); ++i)
+            edges[i] = { uint32_t(i * 3), float(i) * 0.25f };
+        for (size_t i = 0; i < records.size(); ++i)
+            records[i] = { uint8_t(i), double(i) / 3, int16_t(-int(i)) };
+
+        {
+            SerBin<ios::out> writer(filename);
+            writer << edges << records;
+        }
+
+        SerBin<ios::in> reader(filename);
+        vector<pair<uint32_t, float>> loadedEdges;
+        vector<tuple<uint8_t, double, int16_t>> loadedRecords;
+        reader >> loadedEdges >> loadedRecords;
+
+        check(loadedEdges == edges, "packed vector<pair> round trip");
+        check(loadedRecords == records, "packed vector<tuple> round trip");
+        check(reader.stream.tellg() == streamoff(2 * sizeof(size_t) + edges.size() * 8 + records.size() * 11), "packed records carry no padding");
+    }
+
+    // Bit-packed integers, chosen per type and per call, with outliers as exceptions
+    {
+        vector<uint16_t> counts(1000);
+        vector<uint32_t> ids(777);
+        vector<int32_t> deltas(300);
+        for (size_t i = 0; i < counts.size(); ++i)
+            counts[i] = uint16_t(i % 13);
+        for (size_t i = 0; i < ids.size(); ++i)
+            ids[i] = i % 50 == 0 ? 0xFFFFFFFFu - uint32_t(i) : uint32_t(i % 200);
+        for (size_t i = 0; i < deltas.size(); ++i)
+            deltas[i] = int32_t(i % 7) - 3;
+
+        {
+            SerBin<ios::out> writer(filename);
+            writer << counts << encoded<Encoding::BitPacked>(ids) << encoded<Encoding::BitPacked>(deltas);
+        }
+
+        SerBin<ios::in> reader(filename);
+        vector<uint16_t> loadedCounts;
+        vector<uint32_t> loadedIds;
+        vector<int32_t> loadedDeltas;
+        reader >> loadedCounts >> encoded<Encoding::BitPacked>(loadedIds) >> encoded<Encoding::BitPacked>(loadedDeltas);
+
+        check(loadedCounts == counts, "bit-packed vector<uint16_t> round trip");
+        check(loadedIds == ids, "bit-packed vector<uint32_t> with exceptions round trip");
+        check(loadedDeltas == deltas, "bit-packed vector<int32_t> round trip");
+        check(reader.stream.tellg() < streamoff(counts.size() * 2 + ids.size() * 4 / 2), "bit packing shrinks small values");
+    }
+
+    // encodeAs<T> covers std::array<T, N> too
+    {
+        array<uint16_t, 1000> counts;
+        for (size_t i = 0; i < counts.size(); ++i)
+            counts[i] = uint16_t(i % 13);
+
+        {
+            SerBin<ios::out> writer(filename);
+            writer << counts;
+        }
+
+        SerBin<ios::in> reader(filename);
+        array<uint16_t, 1000> loadedCounts{};
+        reader >> loadedCounts;
+
+        check(reader.stream && loadedCounts == counts, "bit-packed array<uint16_t> round trip");
+        check(reader.stream.tellg() < streamoff(counts.size() * 2 / 2), "bit packing shrinks an array");
+    }
+
+    // Lossy float encodings stay within their precision
+    {
+        vector<float> embedding(1000);
+        for (size_t i = 0; i < embedding.size(); ++i)
+            embedding[i] = sin(float(i)) * 3.f;
+
+        {
+            SerBin<ios::out> writer(filename);
+            writer << encoded<Encoding::Float16>(embedding) << encoded<Encoding::BFloat16>(embedding) << encoded<Encoding::QuantizedInt8>(embedding);
+        }
+
+        SerBin<ios::in> reader(filename);
+        vector<float> halves, bfloats, quantized;
+        reader >> encoded<Encoding::Float16>(halves) >> encoded<Encoding::BFloat16>(bfloats) >> encoded<Encoding::QuantizedInt8>(quantized);
+
+        auto maxError = [&](const vector<float>& loaded)
+        {
+            float error = loaded.size() == embedding.size() ? 0.f : INFINITY;
+            for (size_t i = 0; i < loaded.size() && i < embedding.size(); ++i)
+                error = max(error, abs(loaded[i] - embedding[i]));
+            return error;
+        };
+
+        check(maxError(halves) <= 3.f / 1024, "Float16 round trip");
+        check(maxError(bfloats) <= 3.f / 128, "BFloat16 round trip");
+        check(maxError(quantized) <= 3.f / 254 * 1.01f, "QuantizedInt8 round trip");
+        check(reader.stream.tellg() == streamoff(3 * sizeof(size_t) + 1000 * 2 * 2 + 4 * sizeof(float) + 1000), "lossy encodings halve and quarter the payload");
+
+        vector<float> special = { 1.f, NAN, INFINITY, 2.f, -INFINITY };
+        {
+            SerBin<ios::out> writer(filename);
+            writer << encoded<Encoding::QuantizedInt8>(special);
+        }
+
+        SerBin<ios::in> specialReader(filename);
+        vector<float> loaded;
+        specialReader >> encoded<Encoding::QuantizedInt8>(loaded);
+        check(specialReader.stream && loaded.size() == 5 && abs(loaded[0] - 1.f) <= 2.f / 254 && loaded[1] == 0.f && loaded[2] == 2.f && loaded[3] == 2.f && loaded[4] == -2.f,
+            "QuantizedInt8 scales by finite values, stores NaN as 0 and saturates infinities");
+    }
+
+    // Adaptive encoding picks per container from a sample and tags its choice
+    {
+        vector<uint32_t> timestamps(10000), flags(10000), categories(10000), hashes(10000);
+        vector<int16_t> tiny(10);
+        for (size_t i = 0; i < timestamps.size(); ++i)
+        {
+            timestamps[i] = 1700000000u + uint32_t(i * 3 + i % 5);
+            flags[i] = i / 3000;
+            categories[i] = uint32_t(i * 2654435761u) % 300;
+            hashes[i] = uint32_t(i * 2654435761u);
+        }
+
+        MemoryBuffer memory;
+        {
+            SerBin<ios::out> writer(memory);
+            writer << encoded<Encoding::Adaptive>(timestamps) << encoded<Encoding::Adaptive>(flags) << encoded<Encoding::Adaptive>(categories)
+                   << encoded<Encoding::Adaptive>(hashes) << encoded<Encoding::Adaptive>(tiny) << encoded<Encoding::Delta>(tiny)
+                   << encoded<Encoding::RunLength>(hashes);
+        }
+
+        SerBin<ios::in> reader(memory);
+        vector<uint32_t> loaded[5];
+        vector<int16_t> loadedTiny[2];
+        Encoding chosen[4];
+        for (size_t i = 0; i < 4; ++i)
+        {
+            size_t at = size_t(reader.stream.tellg()) + sizeof(size_t);
+            chosen[i] = Encoding(memory.data()[at]);
+            reader >> encoded<Encoding::Adaptive>(loaded[i]);
+        }
+        reader >> encoded<Encoding::Adaptive>(loadedTiny[0]) >> encoded<Encoding::Delta>(loadedTiny[1]) >> encoded<Encoding::RunLength>(loaded[4]);
+
+        check(chosen[0] == Encoding::Delta && chosen[1] == Encoding::RunLength && chosen[2] == Encoding::BitPacked && chosen[3] == Encoding::Raw,
+            "adaptive encoding follows the data");
+        check(loaded[0] == timestamps && loaded[1] == flags && loaded[2] == categories && loaded[3] == hashes, "adaptive round trips");
+        check(loadedTiny[0] == tiny && loadedTiny[1] == tiny && loaded[4] == hashes && reader.stream, "Delta and RunLength round trip");
+
+        string bytes(memory.data(), memory.size());
+        bytes[sizeof(size_t)] = char(Encoding::Float16);
+        FixedReader corrupt(bytes.data(), bytes.size());
+        corrupt >> encoded<Encoding::Adaptive>(loaded[0]);
+        check(!corrupt.stream, "a lossy or unknown adaptive tag is rejected");
+    }
+
+    // A tailing reader sees records as they are appended, and never a partial one
+    {
+        string logname = filename + ".log";
+        remove(logname.c_str());
+
+        TailReader tail(logname);
+        pair<int, string> record;
+        check(!tail.tryNext(record), "tailing a missing file waits");
+
+        thread producer([&]
+        {
+            RecordWriter log(logname);
+            for (int i = 0; i < 50; ++i)
+            {
+                log.append(make_pair(i, string(i, 'x')));
+                if (i % 10 == 0)
+                    this_thread::sleep_for(chrono::milliseconds(5));
+            }
+        });
+
+        int received = 0;
+        while (received < 50 && tail.next(record, chrono::seconds(5)))
+            received += record == make_pair(received, string(received, 'x'));
+
+        producer.join();
+        check(received == 50, "tailed records arrive complete and in order");
+
+        {
+            ofstream partial(logname, ios::binary | ios::app);
+            uint64_t size = sizeof(int) + sizeof(size_t) + 3;
+            partial.write((const char*)&size, sizeof(size));
+            partial.write("\x07\0\0", 3);
+        }
+        check(!tail.next(record, chrono::milliseconds(20)), "a partial record is not yielded");
+
+        {
+            ofstream rest(logname, ios::binary | ios::app);
+            size_t length = 3;
+            rest.write("\0", 1);
+            rest.write((const char*)&length, sizeof(length));
+            rest.write("abc", 3);
+        }
+        check(tail.next(record, chrono::seconds(1)) && record == make_pair(7, string("abc")), "the partial record completes");
+
+        {
+            ofstream torn(logname, ios::binary | ios::app);
+            uint64_t garbage = ~uint64_t(0) >> 4;
+            torn.write((const char*)&garbage, sizeof(garbage));
+            torn.write("xyz", 3);
+        }
+        {
+            NoAllocationScope scope;
+            check(!tail.tryNext(record) && scope.allocations() == 0, "a torn length is not allocated for");
+        }
+        tail.seek(~uint64_t(0) - 4);
+        check(!tail.tryNext(record), "a position past the end waits");
+
+        remove(logname.c_str());
+    }
+
+    // A sparse key index lets a reader seek into a log without scanning it
+    {
+        string logname = filename + ".log";
+        remove(logname.c_str());
+        remove((logname + ".idx").c_str());
+
+        {
+            RecordWriter log(logname, false, 16);
+            for (uint64_t i = 0; i < 1000; ++i)
+                log.append(make_pair(i * 10, string("event")), i * 10);
+        }
+
+        auto keyOf = [](const pair<uint64_t, string>& record) { return record.first; };
+        TailReader reader(logname);
+        pair<uint64_t, string> record;
+
+        check(reader.seekToKey<pair<uint64_t, string>>(4995, keyOf) && reader.tryNext(record) && record.first == 5000, "seek to the first record at or after a key");
+        check(reader.seekToKey<pair<uint64_t, string>>(0, keyOf) && reader.tryNext(record) && record.first == 0, "seek to the first record");
+        check(!reader.seekToKey<pair<uint64_t, string>>(100000, keyOf) && !reader.tryNext(record), "seek past the last record");
+
+        ifstream index(logname + ".idx", ios::binary | ios::ate);
+        check(index.tellg() == streamoff(63 * 2 * sizeof(uint64_t)), "one index entry per stride");
+        index.close();
+
+        remove(logname.c_str());
+        remove((logname + ".idx").c_str());
+
+        {
+            RecordWriter log(logname, false, 16);
+            for (uint64_t i = 0; i < 100; ++i)
+                log.append(set<uint64_t>{ i * 10 }, i * 10);
+        }
+
+        TailReader containers(logname);
+        set<uint64_t> found;
+        check(containers.seekToKey<set<uint64_t>>(555, [](const set<uint64_t>& record) { return *record.begin(); }) && containers.tryNext(found)
+            && found == set<uint64_t>{ 560 }, "seek decodes each container record on its own");
+
+        remove(logname.c_str());
+        remove((logname + ".idx").c_str());
+    }
+
+    // Merkle files verify any range on its own and catch corruption
+    {
+        check(detail::xxhash64("abc", 3) == 0x44BC2CF5AD770999ull, "XXH64 reference value");
+
+        // Reference digests of bytes i * 7, one length per tail and stripe path
+        string pattern;
+        for (int i = 0; i < 1000; ++i)
+            pattern.push_back(char(i * 7));
+
+        const pair<size_t, uint64_t> digests[] = {
+            { 0, 0xEF46DB3751D8E999ull }, { 1, 0xE934A84ADB052768ull }, { 3, 0x9FF70A635A6209ABull },
+            { 4, 0xAE5ACDC00A55AC41ull }, { 7, 0xD734A6B26F3DA63Eull }, { 8, 0x87116B3365B924EBull },
+            { 31, 0x0F187C62B1E722B7ull }, { 32, 0x91B0CB0931A8C629ull }, { 33, 0x931B043CF8D65B94ull },
+            { 100, 0x8E2272C08247D5DBull }, { 1000, 0x25275608A9CFC168ull },
+        };
+        bool allDigests = true;
+        for (auto&& [length, digest] : digests)
+            allDigests &= detail::xxhash64(pattern.data(), length) == digest;
+        check(allDigests, "XXH64 matches reference digests across lengths");
+
+        vector<uint32_t> values(100000);
+        for (size_t i = 0; i < values.size(); ++i)
+            values[i] = uint32_t(i * 7);
+
+        {
+            MerkleWriter writer(filename, 4096, 4);
+            writer << values << string("tail");
+            check(writer.finish(), "Merkle footer written");
+        }
+
+        {
+            MerkleFile file(filename);
+            check(file.isIntact() && file.verify(), "Merkle file verifies");
+
+            MerkleFile::Cursor cursor(file);
+            vector<uint32_t> loaded;
+            string tail;
+            cursor >> loaded >> tail;
+            check(cursor.stream && loaded == values && tail == "tail", "verified cursor reads the encoding back");
+        }
+
+        {
+            fstream corrupt(filename, ios::in | ios::out | ios::binary);
+            corrupt.seekp(5 * 4096 + 100);
+            corrupt.put('\x5A');
+        }
+
+        MerkleFile file(filename);
+        check(file.isIntact() && !file.verify() && !file.verify(5 * 4096, 1) && file.verify(0, 5 * 4096) && file.verify(6 * 4096, 4096), "corruption is confined to its chunk");
+        check(!file.verify(0) && !file.verify(5 * 4096, 4096, 0) && !file.verify(0, ~0ull, 1), "verifying with no threads still reads every chunk");
+
+        MerkleFile::Cursor cursor(file, 4096);
+        uint32_t value = 0;
+        cursor >> value;
+        check(cursor.stream && value == uint32_t((4096 - sizeof(size_t)) / 4 * 7), "untouched chunks still read");
+        cursor.seek(5 * 4096);
+        cursor >> value;
+        check(!cursor.stream, "reads of a corrupt chunk fail");
+
+        {
+            MerkleWriter empty(filename, 0, 0);
+            check(empty.finish() && MerkleFile(filename).verify(), "empty Merkle file with chunk size and threads of 0");
+        }
+        {
+            MerkleWriter tiny(filename, 0, 0);
+            tiny << string("one byte chunks");
+            check(tiny.finish() && MerkleFile(filename).verify(), "Merkle chunk size and threads of 0 count as 1");
+        }
+    }
+
+    // Threads read disjoint records of one file through their own cursors
+    {
+        vector<uint64_t> offsets;
+        {
+            SerBin<ios::out> writer(filename);
+            for (int i = 0; i < 64; ++i)
+            {
+                offsets.push_back(uint64_t(writer.stream.tellp()));
+                writer << "record " + to_string(i) << vector<int>(100 + i, i);
+            }
+        }
+
+        SharedFile file(filename);
+        vector<int> mismatches(4, 0);
+        vector<thread> threads;
+
+        for (int t = 0; t < 4; ++t)
+        {
+            threads.emplace_back([&, t]
+            {
+                SharedFile::Cursor cursor(file);
+                for (int i = 63 - t; i >= 0; i -= 4)
+                {
+                    string name;
+                    vector<int> values;
+                    cursor.seek(offsets[i]);
+                    cursor >> name >> values;
+                    mismatches[t] += name != "record " + to_string(i) || values != vector<int>(100 + i, i);
+                }
+            });
+        }
+
+        for (auto&& thread : threads)
+            thread.join();
+
+        check(mismatches == vector<int>(4, 0), "concurrent cursor reads");
+    }
+
+    // Seeking back after a read larger than the cursor's buffer
+    {
+        {
+            SerBin<ios::out> writer(filename);
+            for (uint32_t i = 0; i < 4096; ++i)
+                writer << i;
+        }
+
+        SharedFile file(filename);
+        SharedFile::Cursor cursor(file, 0, 1024);
+        vector<char> skipped(1020), large(8192);
+        cursor.stream.read(skipped.data(), streamsize(skipped.size()));
+        cursor.stream.read(large.data(), streamsize(large.size()));
+
+        uint32_t value = 0;
+        cursor.seek(4 * 2148);
+        cursor >> value;
+        check(cursor.stream && value == 2148, "cursor seeks after a direct read");
+    }
+
+    // Raw pointers between arenas are swizzled to indices and back
+    {
+        vector<Node> nodes(5);
+        Leaf leaves[3] = { { 0.25 }, { 0.5 }, { 0.75 } };
+        for (int i = 0; i < 5; ++i)
+            nodes[i] = { i, { 2 * i + 1 < 5 ? &nodes[2 * i + 1] : nullptr, 2 * i + 2 < 5 ? &nodes[2 * i + 2] : nullptr }, &leaves[i % 3] };
+
+        MemoryBuffer memory;
+        {
+            SerBin<ios::out> writer(memory);
+            PointerGraph graph;
+            graph.add(nodes).add(leaves, 3);
+            writer << graph;
+            check(bool(writer.stream), "pointer graph writes");
+        }
+
+        vector<Node> loadedNodes;
+        Leaf loadedLeaves[3];
+        SerBin<ios::in> reader(memory);
+        PointerGraph graph;
+        graph.add(loadedNodes).add(loadedLeaves, 3);
+        reader >> graph;
+
+        bool linked = reader.stream && loadedNodes.size() == 5;
+        for (int i = 0; linked && i < 5; ++i)
+        {
+            linked &= loadedNodes[i].value == i && loadedNodes[i].leaf == &loadedLeaves[i % 3];
+            for (int c = 0; c < 2; ++c)
+            {
+                int child = 2 * i + 1 + c;
+                linked &= loadedNodes[i].children[c] == (child < 5 ? &loadedNodes[child] : nullptr);
+            }
+        }
+        check(linked && loadedLeaves[2].weight == 0.75, "pointer graph reloads with links into the new arenas");
+
+        Node stray = nodes[0];
+        stray.children[0] = &nodes[1];
+        nodes[4].children[1] = &stray;
+        MemoryBuffer rejected;
+        SerBin<ios::out> writer(rejected);
+        PointerGraph partial;
+        partial.add(nodes).add(leaves, 3);
+        writer << partial;
+        check(!writer.stream, "pointer outside every arena fails the write");
+    }
+
+    // Small messages compress well against a trained dictionary
+    {
+        auto message = [](int i)
+        {
+            return tuple<string, string, map<string, string>>{ i % 2 ? "GetUserProfile" : "ListOrders", "user-" + to_string(i * 7919 % 10007),
+                { { "content-type", "application/x-serbin" }, { "deadline-ms", to_string(100 + i % 900) } } };
+        };
+
+        vector<string> samples;
+        for (int i = 0; i < 500; ++i)
+        {
+            MemoryBuffer sample;
+            SerBin<ios::out> writer(sample);
+            writer << message(i);
+            samples.emplace_back(sample.data(), sample.size());
+        }
+
+        Compression plain(make_shared<LZCodec>());
+        Compression trained(make_shared<LZCodec>(trainDictionary(42, samples, 4 << 10)));
+        MemoryBuffer withoutDictionary, withDictionary;
+        {
+            SerBin<ios::out> writer(withoutDictionary), dictionaryWriter(withDictionary);
+            for (int i = 1000; i < 1100; ++i)
+            {
+                auto written = message(i);
+                writer << compressed(written, plain);
+                dictionaryWriter << compressed(written, trained);
+            }
+        }
+
+        check(withDictionary.size() * 2 < withoutDictionary.size(), "trained dictionary at least halves small messages");
+
+        bool same = true;
+        SerBin<ios::in> reader(withDictionary);
+        for (int i = 1000; i < 1100; ++i)
+        {
+            decltype(message(i)) loaded;
+            reader >> compressed(loaded, trained);
+            same &= loaded == message(i);
+        }
+        check(reader.stream && same, "compressed messages read back");
+
+        withDictionary.pubseekpos(0);
+        SerBin<ios::in> unknown(withDictionary);
+        decltype(message(0)) loaded;
+        unknown >> compressed(loaded, plain);
+        check(!unknown.stream, "message needing an unknown dictionary fails the read");
+
+        // Hostile or torn headers fail before their sizes are allocated
+        const char* headers[] = { "\x01\x00\x80\x80\x80\x80\x80\x20\x0A", "\x00\x00\x0A\x40", "\x01\x00\x0A\x0B", "\x01\x00" };
+        size_t lengths[] = { 9, 4, 4, 2 };
+        bool rejected = true;
+        for (size_t i = 0; i < 4; ++i)
+        {
+            FixedReader garbage(headers[i], lengths[i]);
+            NoAllocationScope scope;
+            garbage >> compressed(loaded, trained);
+            rejected &= !garbage.stream && scope.allocations() == 0;
+        }
+        check(rejected, "garbage compressed headers are rejected without allocating");
+
+        MemoryBuffer large;
+        {
+            auto first = message(0);
+            SerBin<ios::out> writer(large);
+            writer << compressed(first, plain);
+        }
+        SerBin<ios::in> limited(large);
+        plain.limit(8);
+        limited >> compressed(loaded, plain);
+        check(!limited.stream, "messages over the limit are rejected");
+    }
+
+    // Schema fingerprints follow the serialized shape and reject mismatches up front
+    {
+        static_assert(schemaFingerprint<vector<int>> == schemaFingerprint<list<int>>);
+        static_assert(schemaFingerprint<vector<int>> != schemaFingerprint<vector<unsigned>>);
+        static_assert(schemaFingerprint<vector<uint16_t>> != schemaFingerprint<list<uint16_t>>); // BitPacked
+        static_assert(schemaFingerprint<Custom> == schemaFingerprint<tuple<unique_ptr<tuple<float, double, long long>>>>);
+        static_assert(schemaFingerprint<pair<int, float>> != schemaFingerprint<pair<float, int>>);
+        static_assert(schemaFingerprint<map<string, vector<Custom>>> != schemaFingerprint<map<string, list<vector<Custom>>>>);
+
+        MemoryBuffer memory;
+        SerBin<ios::out> writer(memory);
+        map<string, vector<double>> written = { { "a", { 1.0, 2.0 } } };
+        writer << withSchema(written) << withSchema(written);
+
+        SerBin<ios::in> reader(memory);
+        map<string, vector<double>> loaded;
+        reader >> withSchema(loaded);
+        check(reader.stream && loaded == written, "matching schema reads");
+
+        map<string, vector<float>> mismatched;
+        reader >> withSchema(mismatched);
+        check(!reader.stream && mismatched.empty(), "mismatched schema fails before decoding");
+    }
+
+    // One writer and one reader reused across many small files
+    {
+        SerBin<ios::out> writer("reuse0.bin", 4096);
+        writer << 0;
+        for (int i = 1; i < 4; ++i)
+        {
+            string name = "reuse" + to_string(i) + ".bin";
+            NoAllocationScope scope;
+            writer.open(name);
+            writer << i << array<uint8_t, 4>{ 1, 2, 3, uint8_t(i) };
+            check(scope.allocations() == 0, "reopening a writer allocates nothing");
+        }
+        check(writer.is_open(), "a writer with a file is open");
+        writer.close();
+        check(!writer.is_open(), "a closed writer is not open");
+
+        detail::FileHandle handle = detail::openForReading("reuse3.bin");
+        SerBin<ios::in> reader(handle);
+        check(reader.is_open(), "a reader on a file descriptor is open");
+        int value = 0;
+        array<uint8_t, 4> bytes{};
+        reader >> value >> bytes;
+        check(reader.stream && value == 3 && bytes[3] == 3, "reads from a file descriptor");
+        reader.close();
+        check(!reader.is_open(), "a closed reader lets go of the descriptor");
+        detail::closeFile(handle);
+
+        bool all = true;
+        for (int i = 0; i < 4; ++i)
+        {
+            string name = "reuse" + to_string(i) + ".bin";
+            all &= reader.open(name);
+            reader >> value;
+            all &= reader.stream && value == i;
+            remove(name.c_str());
+        }
+        check(all, "reader reopens file after file");
+
+        check(!reader.open("reuse-missing.bin") && !reader.stream, "reopening a missing file fails");
+        check(!reader.is_open(), "a reader that failed to reopen is not open");
+    }
+
+    // One encode fans out to every destination, through a ring small enough to wrap
+    {
+        MemoryBuffer replica;
+        std::filebuf file;
+        file.open("tee.bin", ios::out | ios::binary | ios::trunc);
+        vector<uint32_t> snapshot(100000);
+        for (size_t i = 0; i < snapshot.size(); ++i)
+            snapshot[i] = uint32_t(i * 2654435761u);
+
+        {
+            TeeWriter writer({ &replica, &file }, 4096, 2);
+            writer << snapshot << string("tail");
+            check(writer.finish(), "tee writer finishes");
+        }
+        file.close();
+
+        vector<uint32_t> fromReplica, fromFile;
+        string tail;
+        SerBin<ios::in> replicaReader(replica);
+        replicaReader >> fromReplica >> tail;
+        SerBin<ios::in> fileReader("tee.bin");
+        fileReader >> fromFile;
+        check(fromReplica == snapshot && fromFile == snapshot && tail == "tail", "every destination gets the same bytes");
+        remove("tee.bin");
+
+        char small[16];
+        detail::FixedBuffer full(small, sizeof(small), true);
+        MemoryBuffer healthy;
+        TeeWriter writer({ &full, &healthy });
+        writer << snapshot;
+        check(!writer.finish() && healthy.size() == sizeof(size_t) + snapshot.size() * sizeof(uint32_t), "failing destination is reported without stalling the others");
+    }
+
+    // Hashing sink digests the encoding without keeping it
+    {
+        map<string, vector<double>> state = { { "a", vector<double>(1000, 0.5) }, { "b", { 1.0 } } };
+        MemoryBuffer encoded;
+        SerBin<ios::out> encoder(encoded);
+        encoder << state;
+        uint64_t expected = detail::xxhash64(encoded.data(), encoded.size());
+
+        HashWriter writer;
+        writer << state;
+        uint64_t first = writer.digest();
+        check(first == expected && hashOf(state) == expected, "hash sink matches hashing the encoded bytes");
+
+        state["b"][0] = 2.0;
+        NoAllocationScope scope;
+        writer.reset();
+        writer << state;
+        check(writer.digest() != first && scope.allocations() == 0, "rehashing detects a change without allocating");
     }
+
+    // Ordered keys compare with memcmp exactly as the keys compare with operator<
+    {
+        using Key = tuple<int32_t, string, optional<double>, uint16_t>;
+        string embedded("a\0b", 3);
+        vector<Key> keys;
+        for (int32_t i : { INT32_MIN, -2, -1, 0, 1, INT32_MAX })
+            for (const string& s : { string(), string("a"), embedded, string("a\xFF"), string("ab") })
+                for (optional<double> d : { optional<double>(), optional<double>(-INFINITY), optional<double>(-1.5), optional<double>(0.0), optional<double>(2.25) })
+                    keys.push_back({ i, s, d, uint16_t(i & 0xFFFF) });
+
+        bool ordered = true, roundTrips = true;
+        for (auto&& a : keys)
+        {
+            string encodedA = encodeKey(a);
+            Key decoded;
+            roundTrips &= decodeKey(encodedA.data(), encodedA.size(), decoded) == encodedA.size() && decoded == a;
+
+            for (auto&& b : keys)
+                ordered &= (encodedA < encodeKey(b)) == (a < b);
+        }
+        check(ordered, "ordered keys sort like the keys");
+        check(roundTrips, "ordered keys decode back");
+
+        vector<wstring> words = { L"", L"b", L"a\x100" };
+        check(encodeKey(words) < encodeKey(vector<wstring>{ L"", L"b", L"b" }) && encodeKey(words) > encodeKey(vector<wstring>{ L"" }), "sequences of wide strings order lexicographically");
+
+        MemoryBuffer memory;
+        SerBin<ios::out> writer(memory);
+        writer << asKey(keys[7]);
+        SerBin<ios::in> reader(memory);
+        Key loaded;
+        reader >> asKey(loaded);
+        check(reader.stream && loaded == keys[7], "ordered keys stream through SerBin");
+
+        string truncated = encodeKey(keys[7]).substr(0, 6);
+        check(decodeKey(truncated.data(), truncated.size(), loaded) == 0, "truncated key is rejected");
+    }
+
+    // Front coding stores each sorted key as a suffix of the previous one
+    {
+        map<string, int> sizes;
+        set<wstring> names;
+        for (int i = 0; i < 1000; ++i)
+        {
+            sizes["/srv/tenants/acme/projects/" + to_string(i / 100) + "/assets/textures/" + to_string(i) + ".png"] = i;
+            names.insert(L"serbin::detail::Fingerprint<" + to_wstring(i) + L">");
+        }
+        names.insert(L"");
+
+        MemoryBuffer plain, coded;
+        size_t codedMapSize;
+        {
+            SerBin<ios::out> plainWriter(plain), codedWriter(coded);
+            plainWriter << sizes;
+            codedWriter << frontCoded(sizes);
+            codedMapSize = coded.size();
+            codedWriter << frontCoded(names);
+        }
+
+        map<string, int> loadedSizes;
+        set<wstring> loadedNames;
+        SerBin<ios::in> reader(coded);
+        reader >> frontCoded(loadedSizes) >> frontCoded(loadedNames);
+
+        check(loadedSizes == sizes && loadedNames == names && reader.stream, "front-coded map and set round trip");
+        check(codedMapSize * 4 < plain.size(), "front coding shrinks path keys");
+
+        string bytes(coded.data(), coded.size());
+        bytes[sizeof(size_t)] = 5; // the first key can't share a prefix
+        FixedReader corrupt(bytes.data(), bytes.size());
+        corrupt >> frontCoded(loadedSizes);
+        check(!corrupt.stream, "front-coded prefix past the previous key is rejected");
+
+        auto frame = [](size_t count, string body) { return string((const char*)&count, sizeof(count)) + body; };
+        string longerPrefix = frame(2, string("\x00\x01" "a\x07\x00\x00\x00" "\x03\x01" "b\x08\x00\x00\x00", 14));
+        string hugeSuffix = frame(1, "\x00\xFF\xFF\xFF\xFF\xFF\xFF\x3F" "abc");
+        map<string, int> hostile;
+        FixedReader prefixReader(longerPrefix.data(), longerPrefix.size()), suffixReader(hugeSuffix.data(), hugeSuffix.size());
+        prefixReader >> frontCoded(hostile);
+        suffixReader >> frontCoded(hostile);
+        check(!prefixReader.stream && !suffixReader.stream && hostile == map<string, int>{ { "a", 7 } }, "hostile front-coded lengths are rejected");
+    }
+
+    // Tries answer lookups and prefix scans on the encoded bytes themselves
+    {
+        set<string> words = { "", "a" };
+        map<string, uint32_t> ranks;
+        for (uint32_t i = 0; i < 3000; ++i)
+        {
+            string word = "auto" + to_string(i * 7919 % 5000) + (i % 3 ? "complete" : "");
+            words.insert(word);
+            ranks[word] = i;
+        }
+
+        MemoryBuffer memory;
+        {
+            SerBin<ios::out> writer(memory);
+            writer << encodeTrie(words) << encodeTrie(ranks) << encodeTrie(set<string>());
+        }
+
+        string setImage, mapImage, emptyImage;
+        SerBin<ios::in> reader(memory);
+        reader >> setImage >> mapImage >> emptyImage;
+        TrieView wordTrie(setImage), rankTrie(mapImage), emptyTrie(emptyImage);
+
+        bool found = wordTrie.valid() && rankTrie.valid() && wordTrie.size() == words.size();
+        for (auto&& [word, rank] : ranks)
+            found = found && wordTrie.contains(word) && rankTrie.find(word) == rank;
+        check(found && wordTrie.contains("") && !rankTrie.contains("") && !wordTrie.contains("auto") && !wordTrie.contains("autocomplete1"),
+            "trie lookups match the set and map");
+
+        vector<string> scanned, expected;
+        wordTrie.forEachWithPrefix("auto12", [&](string_view key, uint64_t) { scanned.emplace_back(key); });
+        for (auto it = words.lower_bound("auto12"); it != words.end() && it->compare(0, 6, "auto12") == 0; ++it)
+            expected.push_back(*it);
+        size_t visited = 0;
+        wordTrie.forEach([&](string_view, uint64_t) { return ++visited < 10; });
+        check(scanned == expected && !expected.empty() && visited == 10, "trie prefix scans are sorted and stop early");
+        check(emptyTrie.valid() && emptyTrie.size() == 0 && !emptyTrie.contains(""), "empty trie");
+        MemoryBuffer plain;
+        SerBin<ios::out> plainWriter(plain);
+        plainWriter << words;
+        check(setImage.size() * 2 < plain.size(), "trie shares prefixes");
+
+        // Damaged images give wrong answers, never out-of-bounds reads
+        for (size_t i = 0; i < 2000; ++i)
+        {
+            string damaged = mapImage;
+            damaged[i * 7919 % damaged.size()] ^= char(1 + i % 255);
+            TrieView view(damaged);
+            view.contains("auto1234complete");
+            view.forEachWithPrefix("auto1", [](string_view, uint64_t) {});
+        }
+    }
+
+    // Roaring sets pick array, bitmap or run chunks and intersect without loading
+    {
+        set<uint32_t> sparse, dense;
+        unordered_set<uint32_t> clustered;
+        for (uint32_t i = 0; i < 5000; ++i)
+        {
+            sparse.insert(i * 2654435761u);
+            dense.insert(70000 + i * 3);
+        }
+        for (uint32_t i = 0; i < 200000; ++i)
+            clustered.insert(i < 100000 ? 65536 + i : 0xFFFF0000u + i % 1000);
+        clustered.insert(70000 + 3 * 77);
+
+        MemoryBuffer memory;
+        {
+            SerBin<ios::out> writer(memory);
+            writer << roaring(sparse) << roaring(dense) << roaring(clustered);
+        }
+        size_t encodedSize = memory.size();
+
+        set<uint32_t> loadedSparse, loadedDense;
+        unordered_set<uint32_t> loadedClustered;
+        SerBin<ios::in> reader(memory);
+        reader >> roaring(loadedSparse) >> roaring(loadedDense) >> roaring(loadedClustered);
+        check(loadedSparse == sparse && loadedDense == dense && loadedClustered == clustered && reader.stream, "roaring round trip");
+        check(encodedSize * 4 < (sparse.size() + dense.size() + clustered.size()) * sizeof(uint32_t), "runs and bitmaps shrink clustered ids");
+
+        string denseImage = encodeRoaring(dense), clusteredImage = encodeRoaring(clustered), sparseImage = encodeRoaring(sparse);
+        RoaringView denseView(denseImage), clusteredView(clusteredImage), sparseView(sparseImage);
+
+        vector<uint32_t> both, expected;
+        denseView.forEachInIntersection(clusteredView, [&](uint32_t value) { both.push_back(value); });
+        for (uint32_t value : dense)
+            if (clustered.count(value))
+                expected.push_back(value);
+
+        check(denseView.size() == dense.size() && denseView.contains(70003) && !denseView.contains(70004) && clusteredView.contains(0xFFFF0000u + 999),
+            "roaring view membership");
+        check(both == expected && sparseView.intersectionSize(sparseView) == sparse.size() && sparseView.intersectionSize(denseView) == 0,
+            "roaring view intersections");
+
+        string damaged = clusteredImage;
+        uint32_t far = 0x7FFFFFFF;
+        memcpy(damaged.data() + 4 + 8, &far, sizeof(far));
+        check(!RoaringView(damaged).valid(), "roaring chunk past the image is rejected");
+    }
+
+    // Decoded objects are cached by offset and shared between reader threads
+    {
+        vector<uint64_t> offsets;
+        {
+            SerBin<ios::out> writer("cache.bin");
+            for (int i = 0; i < 200; ++i)
+            {
+                offsets.push_back(uint64_t(std::streamoff(writer.stream.tellp())));
+                writer << vector<int>(size_t(10 + i % 7), i);
+            }
+        }
+
+        SharedFile file("cache.bin");
+        for (Eviction eviction : { Eviction::LRU, Eviction::Clock })
+        {
+            DecodedCache<vector<int>> cache(4 << 10, eviction, 4);
+            atomic<bool> correct = true;
+            vector<thread> readers;
+            for (unsigned t = 0; t < 4; ++t)
+            {
+                readers.emplace_back([&, t]
+                {
+                    SharedFile::Cursor cursor(file);
+                    for (unsigned n = 0; n < 2000; ++n)
+                    {
+                        // Mostly the first 10 records, sometimes any of them
+                        unsigned i = (n * 7 + t) % 10 == 0 ? (n * 31 + t) % 200 : (n + t) % 10;
+                        auto object = cache.get(cursor, offsets[i]);
+                        if (!object || object->size() != size_t(10 + i % 7) || object->front() != int(i))
+                            correct = false;
+                    }
+                });
+            }
+
+            for (auto&& reader : readers)
+                reader.join();
+
+            check(correct, "cached objects match the file");
+            check(cache.hits() + cache.misses() == 8000 && cache.hits() > 6000, "skewed reads mostly hit the cache");
+        }
+
+        remove("cache.bin");
+    }
+
+    // Incremental encode and decode give the one-shot bytes, a slice at a time
+    {
+        vector<uint16_t> levels(100000); // BitPacked
+        for (size_t i = 0; i < levels.size(); ++i)
+            levels[i] = uint16_t(i * 7 % 1000);
+        map<int, string> names;
+        for (int i = 0; i < 1000; ++i)
+            names[i] = string(size_t(i % 13), 'n');
+        list<vector<double>> history(300, vector<double>(20, 0.25));
+
+        MemoryBuffer oneShot, sliced;
+        {
+            SerBin<ios::out> writer(oneShot);
+            writer << levels << names << history;
+        }
+
+        size_t steps = 0;
+        {
+            SerBin<ios::out> writer(sliced);
+            IncrementalWriter levelsWriter(levels);
+            IncrementalWriter namesWriter(names);
+            IncrementalWriter historyWriter(history);
+            while (!levelsWriter.step(writer, { .bytes = 1 }))
+                ++steps;
+            while (!namesWriter.step(writer, { .bytes = 512 }))
+                ++steps;
+            while (!historyWriter.step(writer, { .time = std::chrono::microseconds(20) }))
+                ++steps;
+        }
+
+        check(steps > 50 && sliced.size() == oneShot.size() && memcmp(sliced.data(), oneShot.data(), oneShot.size()) == 0, "sliced encode writes the one-shot bytes");
+
+        vector<uint16_t> loadedLevels;
+        map<int, string> loadedNames;
+        list<vector<double>> loadedHistory;
+        SerBin<ios::in> reader(sliced);
+        IncrementalReader levelsReader(loadedLevels);
+        IncrementalReader namesReader(loadedNames);
+        IncrementalReader historyReader(loadedHistory);
+        while (!levelsReader.step(reader, { .bytes = 1 }));
+        while (!namesReader.step(reader, { .bytes = 512 }));
+        while (!historyReader.step(reader, { .time = std::chrono::microseconds(20) }));
+        check(reader.stream && loadedLevels == levels && loadedNames == names && loadedHistory == history, "sliced decode reads it back");
+
+        // std::array carries no size prefix either way
+        array<uint32_t, 4> small = { 1, 2, 3, 4 };
+        array<string, 3> words = { "a", "bb", "" };
+        MemoryBuffer arrayShot, arraySliced;
+        {
+            SerBin<ios::out> writer(arrayShot);
+            writer << small << words;
+        }
+        {
+            SerBin<ios::out> writer(arraySliced);
+            IncrementalWriter smallWriter(small);
+            IncrementalWriter wordsWriter(words);
+            while (!smallWriter.step(writer, { .bytes = 1 }));
+            while (!wordsWriter.step(writer, { .bytes = 1 }));
+        }
+        check(arraySliced.size() == arrayShot.size() && arraySliced.size() == 16 + 3 * sizeof(size_t) + 3
+            && memcmp(arraySliced.data(), arrayShot.data(), arrayShot.size()) == 0, "sliced std::array writes the one-shot bytes");
+
+        array<uint32_t, 4> loadedSmall{};
+        array<string, 3> loadedWords;
+        SerBin<ios::in> arrayReader(arraySliced);
+        IncrementalReader smallReader(loadedSmall);
+        IncrementalReader wordsReader(loadedWords);
+        while (!smallReader.step(arrayReader, { .bytes = 1 }));
+        while (!wordsReader.step(arrayReader, { .bytes = 1 }));
+        check(arrayReader.stream && loadedSmall == small && loadedWords == words, "sliced std::array reads back");
+    }
+
+    // Fixed buffers never touch the heap and flag overflow instead of growing
+    {
+        char slot[64];
+        tuple<uint32_t, double, int16_t> message = { 7, 0.5, -3 };
+        NoAllocationScope scope;
+
+        FixedWriter writer(slot, sizeof(slot));
+        writer << message << array<uint8_t, 4>{ 1, 2, 3, 4 };
+        size_t used = writer.size();
+        check(!writer.overflowed() && used == 18, "fixed buffer holds a small message");
+
+        writer << array<uint64_t, 8>{};
+        check(writer.overflowed() && writer.size() == used, "overflow is flagged, nothing partial written");
+
+        FixedReader reader(slot, used);
+        tuple<uint32_t, double, int16_t> loaded;
+        array<uint8_t, 4> bytes;
+        reader >> loaded >> bytes;
+        check(!reader.overflowed() && loaded == message && bytes[3] == 4, "fixed buffer reads back");
+
+        reader >> bytes;
+        check(reader.overflowed() && !reader.stream, "reading past the end is flagged");
+        check(scope.allocations() == 0, "fixed buffers allocate nothing");
+
+        // PODs take the inline path, with the stream path's bytes and overflow
+        char direct[12], streamed[12];
+        FixedWriter fast(direct, sizeof(direct));
+        FixedWriter slow(streamed, sizeof(streamed));
+        fast << uint32_t(0xA1B2C3D4) << 2.5;
+        static_cast<SerBin<ios::out>&>(slow) << uint32_t(0xA1B2C3D4) << 2.5;
+        check(fast.size() == 12 && memcmp(direct, streamed, 12) == 0, "inline POD writes match the stream path");
+        fast << uint8_t(1);
+        check(fast.overflowed() && fast.stream.bad() && fast.size() == 12, "inline POD write overflow");
+
+        FixedReader fastReader(direct, sizeof(direct));
+        uint32_t word = 0;
+        double real = 0;
+        fastReader >> word >> real;
+        check(fastReader.stream && word == 0xA1B2C3D4 && real == 2.5 && fastReader.position() == 12, "inline POD reads");
+        fastReader >> word;
+        check(fastReader.overflowed() && !fastReader.stream, "inline POD read past the end");
+    }
+
+    // Steady state: once open with a preallocated buffer, writes don't touch the heap
+    {
+        SerBin<ios::out> writer(filename, 1 << 16);
+
+        vector<optional<int>> data0 = { {}, 456, 7890 };
+        map<string, bool> data1 = { {"Aurora", true }, {"Borealis", false}, { "Club", true} };
+        unordered_set<wstring> data2 = { {L"Dread"}, {L"Elemental"}, {L"Fang"} };
+        array<double, 4> data3 = { 1.0, 2.0, 3.0, 4.0 };
+        Custom custom;
+
+        writer << data0 << data1 << data2 << data3 << custom;
+
+        NoAllocationScope scope;
+        for (int i = 0; i < 1000; ++i)
+            writer << data0 << data1 << data2 << data3 << custom;
+
+        check(scope.allocations() == 0, "no allocations in steady-state writes");
+    }
+
+    return failures > 0;
 }
@@ -1,10 +1,30 @@
 #pragma once
 #include <fstream>
 #include <concepts>
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <bit>
+#include <new>
+#include <utility>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
 
 #include <memory>
 #include <tuple>
 #include <optional>
+#include <string_view>
 
 #include <array>
 #include <vector>
@@ -17,448 +37,5964 @@
 #include <set>
 #include <unordered_set>
 
+#if defined(__F16C__)
+#include <immintrin.h>
+#define SERBIN_F16C 1
+#endif
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#endif
+
 namespace serbin
 {
     // Big opt-in optimization, mostly for contiguously allocating containers of Ts.
     template<typename T>
     constexpr bool serializeAsPOD = std::is_fundamental_v<T>;
 
-    //////////////////////////////////////////////////////////////////////////////////
-    // Reader / Writer class
-    //////////////////////////////////////////////////////////////////////////////////
-    template<decltype(std::ios::in) mode>
-    class SerBin
+    namespace detail
     {
-        constexpr int getFinalMode()
-        {
-            if constexpr (mode == std::ios::out)
-                return mode | std::ios::binary | std::ios::trunc;
-            else
-                return mode | std::ios::binary;
-        }
+        template<typename T>
+        constexpr bool isPODRecord = false;
 
-    public:
-        SerBin(const std::string& filename)
-        {
-            stream.open(filename, getFinalMode());
-        }
+        template<typename T0, typename T1>
+        constexpr bool isPODRecord<std::pair<T0, T1>> = serializeAsPOD<T0> && serializeAsPOD<T1>;
 
-        ~SerBin()
-        {
-            stream.close();
-        }
+        template<typename... Ts>
+        constexpr bool isPODRecord<std::tuple<Ts...>> = sizeof...(Ts) > 0 && (serializeAsPOD<Ts> && ...);
+    }
 
-        std::fstream stream;
-    };
+    // Containers of std::pair / std::tuple of PODs are written in bulk as dense,
+    // padding-free records - the same bytes as the per-element path. Opt-out.
+    template<typename T>
+    constexpr bool serializeAsPackedRecord = detail::isPODRecord<T>;
 
-    // Fundamental types and opt-in PODs
-    template<typename T, typename = std::enable_if_t<serializeAsPOD<T>>>
-    inline SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const T& object)
+    // Alternative encodings for contiguous containers of PODs. Choose one for
+    // every std::vector<T> and std::array<T, N> by specializing encodeAs<T>, or
+    // for one vector with encoded<Encoding::...>(container) on both the write
+    // and the read.
+    enum class Encoding : uint8_t
     {
-        writer.stream.write((const char*)(&object), sizeof(T));
-        return writer;
-    }
+        Raw,
+        BitPacked, // Integers up to 32 bits: 128-value blocks, per-block width plus exceptions
+        Float16, // Lossy, floating point: IEEE half precision
+        BFloat16, // Lossy, floating point: float with the low 16 mantissa bits rounded off
+        QuantizedInt8, // Lossy, floating point: 256-value blocks of int8 times a float scale
+        Delta, // Integers up to 32 bits: BitPacked differences between neighbours
+        RunLength, // Any POD: [uint16 length - 1][value] per run of equal values
+        Adaptive, // A tag byte, then whichever lossless encoding suits a sample of the values best
+    };
 
-    template<typename T, typename = std::enable_if_t<serializeAsPOD<T>>>
-    inline SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, T& object)
-    {
-        reader.stream.read((char*)(&object), sizeof(T));
-        return reader;
-    }
+    template<typename T>
+    constexpr Encoding encodeAs = Encoding::Raw;
 
-    // Smart pointers
+    // How Encoding::Adaptive weighs decoding speed against size for T: 0 picks
+    // the smallest encoding, 1 always Raw, e.g. 0.5 takes BitPacked over Raw
+    // only when it saves more than about half the bytes.
     template<typename T>
-    inline SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const std::unique_ptr<T>& object)
+    constexpr float adaptiveSpeed = 0.1f;
+
+    template<Encoding E, typename C>
+    struct Encoded
     {
-        writer << bool(object);
+        C& container;
+    };
 
-        if (object)
-            writer << *object;
+    template<Encoding E, typename C>
+    inline Encoded<E, C> encoded(C& container)
+    {
+        return { container };
+    }
 
-        return writer;
+    //////////////////////////////////////////////////////////////////////////////////
+    // Allocation checking
+    //////////////////////////////////////////////////////////////////////////////////
+    namespace detail
+    {
+        inline thread_local int noAllocationDepth = 0;
+        inline thread_local size_t hotPathAllocations = 0;
     }
 
-    template<typename T>
-    inline SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, std::unique_ptr<T>& object)
+    // Marks a hot path, e.g. steady-state writes on a latency-critical thread.
+    // Heap allocations made inside it on this thread are counted when
+    // SERBIN_INTERPOSE_ALLOCATOR is defined in one translation unit, and in
+    // debug builds assert inside the allocator, so a debugger or core dump
+    // shows the allocating call.
+    class NoAllocationScope
     {
-        bool hasValue;
-        reader >> hasValue;
+        size_t startCount = detail::hotPathAllocations;
 
-        if (hasValue)
+    public:
+        NoAllocationScope()
         {
-            object = std::make_unique<T>();
-            reader >> *object;
+            ++detail::noAllocationDepth;
         }
 
-        return reader;
-    }
-
-    template<typename T>
-    inline SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const std::shared_ptr<T>& object)
-    {
-        writer << bool(object);
+        ~NoAllocationScope()
+        {
+            --detail::noAllocationDepth;
+        }
 
-        if (object)
-            writer << *object;
+        NoAllocationScope(const NoAllocationScope&) = delete;
+        NoAllocationScope& operator=(const NoAllocationScope&) = delete;
 
-        return writer;
-    }
+        size_t allocations() const
+        {
+            return detail::hotPathAllocations - startCount;
+        }
+    };
 
-    template<typename T>
-    inline SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, std::shared_ptr<T>& object)
+    //////////////////////////////////////////////////////////////////////////////////
+    // Platform
+    //////////////////////////////////////////////////////////////////////////////////
+    namespace detail
     {
-        bool hasValue;
-        reader >> hasValue;
+#if defined(_WIN32)
+        using FileHandle = HANDLE;
+        inline const FileHandle invalidFile = INVALID_HANDLE_VALUE;
 
-        if (hasValue)
+        inline FileHandle openForReading(const std::string& filename)
         {
-            object = std::make_shared<T>();
-            reader >> *object;
+            return CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
         }
 
-        return reader;
-    }
+        inline void closeFile(FileHandle handle)
+        {
+            CloseHandle(handle);
+        }
 
-    // std::string, std::wstring etc
-    template<typename T>
-    inline SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const std::basic_string<T>& object)
-    {
-        writer << object.size();
+        inline uint64_t fileSize(FileHandle handle)
+        {
+            LARGE_INTEGER size;
+            return GetFileSizeEx(handle, &size) ? uint64_t(size.QuadPart) : 0;
+        }
 
-        if (object.size() > 0)
-            writer.stream.write((const char*)(object.data()), object.size() * sizeof(T));
+        inline size_t readAt(FileHandle handle, uint64_t offset, char* target, size_t count)
+        {
+            size_t done = 0;
 
-        return writer;
-    }
+            while (done < count)
+            {
+                OVERLAPPED overlapped = {};
+                overlapped.Offset = DWORD(offset + done);
+                overlapped.OffsetHigh = DWORD((offset + done) >> 32);
 
-    template<typename T>
-    inline SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, std::basic_string<T>& object)
-    {
-        decltype(object.size()) s;
-        reader >> s;
+                DWORD chunk = 0;
+                if (!ReadFile(handle, target + done, DWORD(std::min<size_t>(count - done, 1u << 30)), &chunk, &overlapped) || chunk == 0)
+                    break;
 
-        if (s > 0)
+                done += chunk;
+            }
+
+            return done;
+        }
+
+        // At the handle's current position
+        inline size_t readSome(FileHandle handle, char* target, size_t count)
         {
-            object.resize(s);
-            reader.stream.read((char*)(object.data()), object.size() * sizeof(T));
+            DWORD chunk = 0;
+            return ReadFile(handle, target, DWORD(std::min<size_t>(count, 1u << 30)), &chunk, nullptr) ? chunk : 0;
         }
 
-        return reader;
-    }
+        inline bool writeAll(FileHandle handle, const char* source, size_t count)
+        {
+            for (size_t done = 0; done < count;)
+            {
+                DWORD chunk = 0;
+                if (!WriteFile(handle, source + done, DWORD(std::min<size_t>(count - done, 1u << 30)), &chunk, nullptr) || chunk == 0)
+                    return false;
 
-    // std::vector
-    template<typename T>
-    inline SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const std::vector<T>& object)
-    {
-        writer << object.size();
-        if constexpr (serializeAsPOD<T>)
+                done += chunk;
+            }
+
+            return true;
+        }
+#else
+        using FileHandle = int;
+        constexpr FileHandle invalidFile = -1;
+
+        inline FileHandle openForReading(const std::string& filename)
         {
-            if (object.size() > 0)
-                writer.stream.write((const char*)(&object[0]), sizeof(T) * object.size());
+            return ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
         }
-        else
+
+        inline void closeFile(FileHandle handle)
         {
-            for (auto&& value : object)
-                writer << value;
+            ::close(handle);
         }
 
-        return writer;
-    }
+        inline uint64_t fileSize(FileHandle handle)
+        {
+            struct stat info;
+            return fstat(handle, &info) == 0 ? uint64_t(info.st_size) : 0;
+        }
 
-    template<typename T>
-    inline SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, std::vector<T>& object)
-    {
-        decltype(object.size()) s;
-        reader >> s;
+        // Positional, so safe to call from many threads on one handle
+        inline size_t readAt(FileHandle handle, uint64_t offset, char* target, size_t count)
+        {
+            size_t done = 0;
 
-        if (s == 0)
-            return reader;
+            while (done < count)
+            {
+                ssize_t chunk = ::pread(handle, target + done, count - done, off_t(offset + done));
+                if (chunk < 0 && errno == EINTR)
+                    continue;
+                if (chunk <= 0)
+                    break;
 
-        object.resize(s);
+                done += size_t(chunk);
+            }
 
-        if constexpr (serializeAsPOD<T>)
-        {
-            reader.stream.read((char*)(&object[0]), sizeof(T) * s);
+            return done;
         }
-        else
+
+        // At the handle's current position
+        inline size_t readSome(FileHandle handle, char* target, size_t count)
         {
-            for (auto&& value : object)
-                reader >> value;
+            for (;;)
+            {
+                ssize_t chunk = ::read(handle, target, count);
+                if (chunk < 0 && errno == EINTR)
+                    continue;
+
+                return chunk > 0 ? size_t(chunk) : 0;
+            }
         }
 
-        return reader;
+        inline bool writeAll(FileHandle handle, const char* source, size_t count)
+        {
+            for (size_t done = 0; done < count;)
+            {
+                ssize_t chunk = ::write(handle, source + done, count - done);
+                if (chunk < 0 && errno == EINTR)
+                    continue;
+                if (chunk <= 0)
+                    return false;
+
+                done += size_t(chunk);
+            }
+
+            return true;
+        }
+#endif
     }
 
-    // std::array
-    template<typename T, size_t N>
-    inline SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const std::array<T, N>& object)
+    namespace detail
     {
-        if constexpr (N > 0)
+        // Buffered reads or writes on a file handle the caller opened and closes
+        class HandleBuffer : public std::streambuf
         {
-            if constexpr (serializeAsPOD<T>)
+            FileHandle handle = invalidFile;
+            char* buffer = nullptr;
+            size_t capacity = 0;
+
+            bool flushPending()
             {
-                writer.stream.write((const char*)(&object[0]), sizeof(T) * N);
+                size_t pending = size_t(pptr() - pbase());
+                setp(pbase(), epptr());
+                return pending == 0 || writeAll(handle, pbase(), pending);
             }
-            else
+
+        public:
+            void attach(FileHandle target, char* buffer, size_t capacity, bool writing)
             {
-                for (auto&& value : object)
-                    writer << value;
-            }
-        }
+                handle = target;
+                this->buffer = buffer;
+                this->capacity = capacity;
 
-        return writer;
-    }
+                if (writing)
+                    setp(buffer, buffer + capacity);
+                else
+                    setg(buffer, buffer, buffer);
+            }
 
-    template<typename T, size_t N>
-    inline SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, std::array<T, N>& object)
-    {
-        if constexpr (N > 0)
-        {
-            if constexpr (serializeAsPOD<T>)
+            bool attached() const
             {
-                reader.stream.read((char*)(&object[0]), sizeof(T) * N);
+                return handle != invalidFile;
             }
-            else
+
+            // Flushes, then lets go of the handle without closing it
+            bool detach()
             {
-                for (auto&& value : object)
-                    reader >> value;
+                bool flushed = handle == invalidFile || flushPending();
+                handle = invalidFile;
+                setp(nullptr, nullptr);
+                setg(nullptr, nullptr, nullptr);
+                return flushed;
             }
-        }
 
-        return reader;
-    }
+        protected:
+            int_type overflow(int_type ch) override
+            {
+                if (handle == invalidFile || pbase() == nullptr || !flushPending())
+                    return traits_type::eof();
 
-    // std::list
-    template<typename T>
-    inline SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const std::list<T>& object)
-    {
-        writer << object.size();
+                if (!traits_type::eq_int_type(ch, traits_type::eof()))
+                {
+                    *pptr() = traits_type::to_char_type(ch);
+                    pbump(1);
+                }
 
-        for (auto&& value : object)
-            writer << value;
+                return traits_type::not_eof(ch);
+            }
 
-        return writer;
+            int sync() override
+            {
+                return handle == invalidFile || pbase() == nullptr || flushPending() ? 0 : -1;
+            }
+
+            int_type underflow() override
+            {
+                if (handle == invalidFile || eback() == nullptr)
+                    return traits_type::eof();
+
+                size_t count = readSome(handle, buffer, capacity);
+                setg(buffer, buffer, buffer + count);
+                return count > 0 ? traits_type::to_int_type(*buffer) : traits_type::eof();
+            }
+        };
     }
 
-    template<typename T>
-    inline SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, std::list<T>& object)
+    //////////////////////////////////////////////////////////////////////////////////
+    // Reader / Writer class
+    //////////////////////////////////////////////////////////////////////////////////
+    template<decltype(std::ios::in) mode>
+    class SerBin
     {
-        decltype(object.size()) s;
-        reader >> s;
+        // Declared before file and handleBuffer, which still flush into it when closed
+        std::unique_ptr<char[]> buffer;
+        size_t bufferSize;
+        std::filebuf file;
+        detail::HandleBuffer handleBuffer;
 
-        for (decltype(s) i = 0; i < s; ++i)
+        constexpr std::ios::openmode getFinalMode()
         {
-            object.push_back(T());
-            reader >> object.back();
+            if constexpr (mode == std::ios::out)
+                return mode | std::ios::binary | std::ios::trunc;
+            else
+                return mode | std::ios::binary;
         }
 
-        return reader;
-    }
+        // Kept from one file to the next, so reopening doesn't allocate
+        char* reusableBuffer()
+        {
+            if (!buffer)
+            {
+                bufferSize = bufferSize > 0 ? bufferSize : BUFSIZ;
+                buffer = std::make_unique<char[]>(bufferSize);
+            }
 
-    // std::deque
-    template<typename T>
-    inline SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const std::deque<T>& object)
-    {
-        writer << object.size();
+            return buffer.get();
+        }
 
-        for (auto&& value : object)
-            writer << value;
+    public:
+        // bufferSize replaces the std::filebuf default (BUFSIZ), 0 keeps it
+        SerBin(const std::string& filename, size_t bufferSize = 0)
+            : bufferSize(bufferSize), stream(&file)
+        {
+            if (bufferSize > 0)
+                file.pubsetbuf(reusableBuffer(), bufferSize);
 
-        return writer;
-    }
+            if (!file.open(filename, getFinalMode()))
+                stream.setstate(std::ios::failbit);
+        }
 
-    template<typename T>
-    inline SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, std::deque<T>& object)
-    {
-        decltype(object.size()) s;
-        reader >> s;
+        // Over a file descriptor (a HANDLE on Windows) that stays open when
+        // this is closed or destroyed. Reads and writes start at its position;
+        // reads buffer ahead of what has been decoded.
+        explicit SerBin(detail::FileHandle handle, size_t bufferSize = 0)
+            : bufferSize(bufferSize), stream(&handleBuffer)
+        {
+            open(handle);
+        }
 
-        for (decltype(s) i = 0; i < s; ++i)
+        // Reads or writes through any stream buffer instead of a file
+        SerBin(std::streambuf& target)
+            : bufferSize(0), stream(&target)
         {
-            object.push_back(T());
-            reader >> object.back();
         }
 
-        return reader;
-    }
+        ~SerBin()
+        {
+            close();
+        }
 
-    // std::set
+        // Flushes and closes the current file, or lets go of the descriptor or
+        // stream buffer. Buffers stay for the next open().
+        void close()
+        {
+            if constexpr (mode == std::ios::out)
+                stream.flush();
+
+            file.close();
+            handleBuffer.detach();
+        }
+
+        // Closes whatever is open and opens another file with the same buffer
+        // and stream, which saves their setup when going through many small
+        // files. false, with failbit set, if it can't be opened.
+        bool open(const std::string& filename)
+        {
+            close();
+            stream.clear();
+            stream.rdbuf(&file);
+            char* reused = reusableBuffer();
+            file.pubsetbuf(reused, bufferSize);
+
+            if (file.open(filename, getFinalMode()))
+                return true;
+
+            stream.setstate(std::ios::failbit);
+            return false;
+        }
+
+        bool open(detail::FileHandle handle)
+        {
+            close();
+            stream.clear();
+            stream.rdbuf(&handleBuffer);
+            char* reused = reusableBuffer();
+            handleBuffer.attach(handle, reused, bufferSize, mode == std::ios::out);
+
+            if (handle != detail::invalidFile)
+                return true;
+
+            stream.setstate(std::ios::failbit);
+            return false;
+        }
+
+        // Switches to any stream buffer, e.g. the next MemoryBuffer
+        void reset(std::streambuf& target)
+        {
+            close();
+            stream.clear();
+            stream.rdbuf(&target);
+        }
+
+        // What stream.is_open() answered while stream was a std::fstream: a
+        // file or descriptor is open, or a stream buffer is attached
+        bool is_open() const
+        {
+            if (stream.rdbuf() == &file)
+                return file.is_open();
+            if (stream.rdbuf() == &handleBuffer)
+                return handleBuffer.attached();
+
+            return stream.rdbuf() != nullptr;
+        }
+
+        std::iostream stream;
+    };
+
+    //////////////////////////////////////////////////////////////////////////////////
+    // Memory
+    //////////////////////////////////////////////////////////////////////////////////
+    // Growable in-memory stream buffer. Reads see everything written so far, and
+    // clear() keeps the capacity, so a reused buffer stops allocating.
+    class MemoryBuffer : public std::streambuf
+    {
+        std::vector<char> storage;
+
+        void place(size_t written, size_t readPosition)
+        {
+            char* base = storage.data();
+            setp(base, base + storage.size());
+            for (size_t left = written; left > 0;)
+            {
+                int step = int(std::min<size_t>(left, INT_MAX));
+                pbump(step);
+                left -= size_t(step);
+            }
+
+            setg(base, base + readPosition, base + written);
+        }
+
+        void reserveFor(size_t count)
+        {
+            size_t written = size();
+            if (storage.size() - written >= count)
+                return;
+
+            size_t readPosition = size_t(gptr() - eback());
+            storage.resize(std::max(storage.size() * 2, written + count));
+            place(written, readPosition);
+        }
+
+    public:
+        explicit MemoryBuffer(size_t capacity = 0)
+            : storage(capacity)
+        {
+            place(0, 0);
+        }
+
+        MemoryBuffer(const MemoryBuffer&) = delete;
+        MemoryBuffer& operator=(const MemoryBuffer&) = delete;
+
+        const char* data() const
+        {
+            return pbase();
+        }
+
+        size_t size() const
+        {
+            return size_t(pptr() - pbase());
+        }
+
+        void clear()
+        {
+            place(0, 0);
+        }
+
+        // Room for count more bytes, e.g. to fill from a file; commit() what was filled
+        char* prepare(size_t count)
+        {
+            reserveFor(count);
+            return pptr();
+        }
+
+        void commit(size_t count)
+        {
+            place(size() + count, size_t(gptr() - eback()));
+        }
+
+    protected:
+        int_type overflow(int_type ch) override
+        {
+            if (traits_type::eq_int_type(ch, traits_type::eof()))
+                return traits_type::not_eof(ch);
+
+            reserveFor(1);
+            *pptr() = traits_type::to_char_type(ch);
+            pbump(1);
+            return ch;
+        }
+
+        std::streamsize xsputn(const char* source, std::streamsize count) override
+        {
+            std::memcpy(prepare(size_t(count)), source, size_t(count));
+            commit(size_t(count));
+            return count;
+        }
+
+        int_type underflow() override
+        {
+            if (gptr() >= pptr())
+                return traits_type::eof();
+
+            setg(eback(), gptr(), pptr());
+            return traits_type::to_int_type(*gptr());
+        }
+
+        pos_type seekoff(off_type offset, std::ios::seekdir direction, std::ios::openmode which) override
+        {
+            off_type base = direction == std::ios::beg ? 0 : direction == std::ios::end ? off_type(size())
+                : (which & std::ios::in) ? off_type(gptr() - eback()) : off_type(size());
+            return seekpos(pos_type(base + offset), which);
+        }
+
+        // Reads may seek anywhere in the written bytes; writes only append
+        pos_type seekpos(pos_type position, std::ios::openmode which) override
+        {
+            off_type target = off_type(position);
+            if (target < 0 || target > off_type(size()))
+                return pos_type(off_type(-1));
+
+            if (which & std::ios::in)
+                setg(eback(), eback() + target, pptr());
+            else if (target != off_type(size()))
+                return pos_type(off_type(-1));
+
+            return position;
+        }
+    };
+
+    namespace detail
+    {
+        // Get or put area over the caller's bytes. A transfer that doesn't fit
+        // moves nothing and sets a flag; nothing grows and nothing throws.
+        class FixedBuffer : public std::streambuf
+        {
+            bool overran = false;
+
+        public:
+            FixedBuffer(char* data, size_t capacity, bool writable)
+            {
+                if (writable)
+                    setp(data, data + capacity);
+                else
+                    setg(data, data, data + capacity);
+            }
+
+            bool overflowed() const
+            {
+                return overran;
+            }
+
+            // What xsputn and xsgetn do, callable inline: one bounds check and a
+            // memcpy. Nothing moves once the buffer has overrun.
+            bool put(const void* source, size_t count)
+            {
+                if (overran || count > size_t(epptr() - pptr()))
+                {
+                    overran = true;
+                    return false;
+                }
+
+                std::memcpy(pptr(), source, count);
+                pbump(int(count));
+                return true;
+            }
+
+            bool get(void* target, size_t count)
+            {
+                if (overran || count > size_t(egptr() - gptr()))
+                {
+                    overran = true;
+                    return false;
+                }
+
+                std::memcpy(target, gptr(), count);
+                gbump(int(count));
+                return true;
+            }
+
+        protected:
+            int_type overflow(int_type ch) override
+            {
+                overran |= !traits_type::eq_int_type(ch, traits_type::eof());
+                return traits_type::eof();
+            }
+
+            std::streamsize xsputn(const char* source, std::streamsize count) final
+            {
+                if (count > epptr() - pptr())
+                {
+                    overran = true;
+                    return 0;
+                }
+
+                std::memcpy(pptr(), source, size_t(count));
+                pbump(int(count));
+                return count;
+            }
+
+            int_type underflow() override
+            {
+                overran = true;
+                return traits_type::eof();
+            }
+
+            std::streamsize xsgetn(char* target, std::streamsize count) final
+            {
+                if (count > egptr() - gptr())
+                {
+                    overran = true;
+                    return 0;
+                }
+
+                std::memcpy(target, gptr(), size_t(count));
+                gbump(int(count));
+                return count;
+            }
+        };
+    }
+
+    // Writes into a fixed caller-owned buffer, e.g. a stack array or a message
+    // slot, for code that can't touch the heap. A write that doesn't fit sets
+    // overflowed() and the stream's badbit instead of growing or throwing.
+    class FixedWriter : private detail::FixedBuffer, public SerBin<std::ios::out>
+    {
+    public:
+        FixedWriter(void* data, size_t capacity)
+            : detail::FixedBuffer((char*)data, capacity, true), SerBin<std::ios::out>(static_cast<std::streambuf&>(*this))
+        {
+        }
+
+        using detail::FixedBuffer::overflowed;
+
+        // Bytes written so far
+        size_t size() const
+        {
+            return size_t(pptr() - pbase());
+        }
+
+        // Raw bytes, straight into the buffer
+        bool write(const void* data, size_t size)
+        {
+            if (put(data, size))
+                return true;
+
+            stream.setstate(std::ios::badbit);
+            return false;
+        }
+    };
+
+    // PODs skip the stream's sentry and virtual call, with the same bytes and
+    // overflow behaviour
+    template<typename T, typename = std::enable_if_t<serializeAsPOD<T>>>
+    inline FixedWriter& operator<<(FixedWriter& writer, const T& object)
+    {
+        writer.write(&object, sizeof(T));
+        return writer;
+    }
+
+    // Reads from a fixed caller-owned buffer; reading past its end sets
+    // overflowed() and the stream's failbit.
+    class FixedReader : private detail::FixedBuffer, public SerBin<std::ios::in>
+    {
+    public:
+        FixedReader(const void* data, size_t size)
+            : detail::FixedBuffer((char*)data, size, false), SerBin<std::ios::in>(static_cast<std::streambuf&>(*this))
+        {
+        }
+
+        using detail::FixedBuffer::overflowed;
+
+        // Bytes read so far
+        size_t position() const
+        {
+            return size_t(gptr() - eback());
+        }
+
+        // Raw bytes, straight out of the buffer
+        bool read(void* data, size_t size)
+        {
+            if (get(data, size))
+                return true;
+
+            stream.setstate(std::ios::eofbit | std::ios::failbit);
+            return false;
+        }
+    };
+
+    template<typename T, typename = std::enable_if_t<serializeAsPOD<T>>>
+    inline FixedReader& operator>>(FixedReader& reader, T& object)
+    {
+        reader.read(&object, sizeof(T));
+        return reader;
+    }
+
+    //////////////////////////////////////////////////////////////////////////////////
+    // Concurrent positional reads
+    //////////////////////////////////////////////////////////////////////////////////
+    namespace detail
+    {
+        // Get area over a private buffer, refilled with positional reads
+        class PositionalBuffer : public std::streambuf
+        {
+            FileHandle handle;
+            std::unique_ptr<char[]> buffer;
+            size_t capacity;
+            uint64_t next; // File offset just past the get area
+
+        public:
+            PositionalBuffer(FileHandle handle, uint64_t offset, size_t capacity)
+                : handle(handle), buffer(std::make_unique<char[]>(capacity)), capacity(capacity), next(offset)
+            {
+            }
+
+        protected:
+            int_type underflow() override
+            {
+                if (gptr() < egptr())
+                    return traits_type::to_int_type(*gptr());
+
+                size_t count = readAt(handle, next, buffer.get(), capacity);
+                if (count == 0)
+                    return traits_type::eof();
+
+                setg(buffer.get(), buffer.get(), buffer.get() + count);
+                next += count;
+                return traits_type::to_int_type(*gptr());
+            }
+
+            // Large reads skip the buffer and land in the target directly
+            std::streamsize xsgetn(char* target, std::streamsize count) override
+            {
+                std::streamsize buffered = std::min<std::streamsize>(count, egptr() - gptr());
+                if (buffered > 0)
+                {
+                    std::memcpy(target, gptr(), size_t(buffered));
+                    gbump(int(buffered));
+                }
+
+                std::streamsize remaining = count - buffered;
+                if (remaining == 0)
+                    return count;
+
+                if (size_t(remaining) >= capacity)
+                {
+                    size_t direct = readAt(handle, next, target + buffered, size_t(remaining));
+                    next += direct;
+                    setg(buffer.get(), buffer.get(), buffer.get()); // the window no longer ends at next
+                    return buffered + std::streamsize(direct);
+                }
+
+                return buffered + std::streambuf::xsgetn(target + buffered, remaining);
+            }
+
+            pos_type seekoff(off_type offset, std::ios::seekdir direction, std::ios::openmode which) override
+            {
+                if (direction == std::ios::cur && offset == 0)
+                    return pos_type(off_type(next) - (egptr() - gptr()));
+                if (direction == std::ios::cur)
+                    return seekpos(pos_type(off_type(next) - (egptr() - gptr()) + offset), which);
+                if (direction == std::ios::end)
+                    return seekpos(pos_type(off_type(fileSize(handle)) + offset), which);
+
+                return seekpos(pos_type(offset), which);
+            }
+
+            pos_type seekpos(pos_type position, std::ios::openmode which) override
+            {
+                if (!(which & std::ios::in) || off_type(position) < 0)
+                    return pos_type(off_type(-1));
+
+                // Seeks inside the buffered window keep it
+                uint64_t target = uint64_t(off_type(position));
+                uint64_t windowStart = next - uint64_t(egptr() - eback());
+                if (target >= windowStart && target <= next)
+                {
+                    setg(eback(), eback() + (target - windowStart), egptr());
+                    return position;
+                }
+
+                next = target;
+                setg(buffer.get(), buffer.get(), buffer.get());
+                return position;
+            }
+        };
+    }
+
+    // A file opened once and read by many threads at once. Each thread makes
+    // its own Cursor, which carries a private offset and read buffer and reads
+    // with pread, so no file position is shared.
+    class SharedFile
+    {
+        detail::FileHandle handle;
+
+    public:
+        class Cursor;
+
+        explicit SharedFile(const std::string& filename)
+            : handle(detail::openForReading(filename))
+        {
+        }
+
+        ~SharedFile()
+        {
+            if (isOpen())
+                detail::closeFile(handle);
+        }
+
+        SharedFile(const SharedFile&) = delete;
+        SharedFile& operator=(const SharedFile&) = delete;
+
+        bool isOpen() const
+        {
+            return handle != detail::invalidFile;
+        }
+
+        uint64_t size() const
+        {
+            return detail::fileSize(handle);
+        }
+
+        detail::FileHandle nativeHandle() const
+        {
+            return handle;
+        }
+    };
+
+    // Usable wherever a SerBin<std::ios::in> is. Cheap to create per lookup;
+    // the only allocation is the read buffer.
+    class SharedFile::Cursor : private detail::PositionalBuffer, public SerBin<std::ios::in>
+    {
+    public:
+        explicit Cursor(const SharedFile& file, uint64_t offset = 0, size_t bufferSize = 16 << 10)
+            : detail::PositionalBuffer(file.nativeHandle(), offset, bufferSize), SerBin<std::ios::in>(static_cast<std::streambuf&>(*this))
+        {
+            if (!file.isOpen())
+                stream.setstate(std::ios::failbit);
+        }
+
+        void seek(uint64_t offset)
+        {
+            stream.clear();
+            stream.seekg(std::streamoff(offset));
+        }
+
+        uint64_t tell()
+        {
+            return uint64_t(std::streamoff(stream.tellg()));
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////////////////////
+    // Decoded-object cache
+    //////////////////////////////////////////////////////////////////////////////////
+    enum class Eviction : uint8_t
+    {
+        LRU, // Hits move the entry to the front, under the shard's exclusive lock
+        Clock, // Hits only set a flag, under a shared lock; the hand gives flagged entries a second chance
+    };
+
+    // Decoded objects keyed by file offset, shared between reader threads and
+    // bounded by a memory budget. Objects are handed out as shared_ptr<const T>,
+    // so one that gets evicted stays valid for whoever still holds it. Offsets
+    // are spread over shards, each with its own lock and its share of the budget.
     template<typename T>
-    inline SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const std::set<T>& object)
+    class DecodedCache
     {
-        writer << object.size();
+        struct Entry
+        {
+            uint64_t offset;
+            std::shared_ptr<const T> object;
+            size_t cost;
+            std::atomic<bool> referenced{ false };
+
+            Entry(uint64_t offset, std::shared_ptr<const T> object, size_t cost)
+                : offset(offset), object(std::move(object)), cost(cost)
+            {
+            }
+        };
+
+        struct Shard
+        {
+            std::shared_mutex lock;
+            std::list<Entry> entries; // LRU: most recent first. Clock: the ring.
+            std::unordered_map<uint64_t, typename std::list<Entry>::iterator> index;
+            typename std::list<Entry>::iterator hand;
+            size_t cost = 0;
+        };
+
+        std::unique_ptr<Shard[]> shards;
+        size_t shardCount;
+        size_t shardBudget;
+        Eviction eviction;
+        std::atomic<uint64_t> hitCount{ 0 }, missCount{ 0 };
+
+        Shard& shardFor(uint64_t offset)
+        {
+            return shards[size_t((offset * 0x9E3779B97F4A7C15ull) >> 32) % shardCount];
+        }
+
+        void evictOne(Shard& shard)
+        {
+            auto victim = shard.entries.end();
+
+            if (eviction == Eviction::LRU)
+            {
+                victim = std::prev(shard.entries.end());
+            }
+            else
+            {
+                for (;; ++shard.hand)
+                {
+                    if (shard.hand == shard.entries.end())
+                        shard.hand = shard.entries.begin();
+                    if (!shard.hand->referenced.exchange(false, std::memory_order_relaxed))
+                        break;
+                }
+
+                victim = shard.hand++;
+            }
+
+            shard.cost -= victim->cost;
+            shard.index.erase(victim->offset);
+            shard.entries.erase(victim);
+        }
+
+    public:
+        explicit DecodedCache(size_t budgetBytes, Eviction eviction = Eviction::LRU, size_t shards = 8)
+            : shards(std::make_unique<Shard[]>(std::max<size_t>(shards, 1))), shardCount(std::max<size_t>(shards, 1)),
+              shardBudget(budgetBytes / shardCount), eviction(eviction)
+        {
+            for (size_t i = 0; i < shardCount; ++i)
+                this->shards[i].hand = this->shards[i].entries.end();
+        }
+
+        DecodedCache(const DecodedCache&) = delete;
+        DecodedCache& operator=(const DecodedCache&) = delete;
+
+        std::shared_ptr<const T> find(uint64_t offset)
+        {
+            Shard& shard = shardFor(offset);
+
+            if (eviction == Eviction::Clock)
+            {
+                std::shared_lock<std::shared_mutex> guard(shard.lock);
+                auto found = shard.index.find(offset);
+                if (found == shard.index.end())
+                    return {};
+
+                found->second->referenced.store(true, std::memory_order_relaxed);
+                return found->second->object;
+            }
+
+            std::unique_lock<std::shared_mutex> guard(shard.lock);
+            auto found = shard.index.find(offset);
+            if (found == shard.index.end())
+                return {};
+
+            shard.entries.splice(shard.entries.begin(), shard.entries, found->second);
+            return found->second->object;
+        }
+
+        // cost is charged against the budget; an object costing more than a
+        // shard's share is returned but not kept. If another thread got there
+        // first, its object is kept and returned instead.
+        std::shared_ptr<const T> insert(uint64_t offset, T object, size_t cost)
+        {
+            auto shared = std::make_shared<const T>(std::move(object));
+            if (cost > shardBudget)
+                return shared;
+
+            Shard& shard = shardFor(offset);
+            std::unique_lock<std::shared_mutex> guard(shard.lock);
+
+            auto found = shard.index.find(offset);
+            if (found != shard.index.end())
+                return found->second->object;
+
+            while (shard.cost + cost > shardBudget)
+                evictOne(shard);
+
+            // LRU: at the front. Clock: just behind the hand, the last place it reaches.
+            auto position = eviction == Eviction::LRU ? shard.entries.begin() : shard.hand;
+            auto entry = shard.entries.emplace(position, offset, shared, cost);
+            shard.index.emplace(offset, entry);
+            shard.cost += cost;
+            return shared;
+        }
+
+        // The object at offset, decoded with cursor on a miss and charged at
+        // sizeof(T) plus its encoded size; null if it doesn't decode
+        std::shared_ptr<const T> get(SharedFile::Cursor& cursor, uint64_t offset)
+        {
+            if (auto cached = find(offset))
+            {
+                hitCount.fetch_add(1, std::memory_order_relaxed);
+                return cached;
+            }
+
+            missCount.fetch_add(1, std::memory_order_relaxed);
+
+            T object;
+            cursor.seek(offset);
+            cursor >> object;
+            if (!cursor.stream)
+                return {};
+
+            return insert(offset, std::move(object), sizeof(T) + size_t(cursor.tell() - offset));
+        }
+
+        void clear()
+        {
+            for (size_t i = 0; i < shardCount; ++i)
+            {
+                std::unique_lock<std::shared_mutex> guard(shards[i].lock);
+                shards[i].index.clear();
+                shards[i].entries.clear();
+                shards[i].hand = shards[i].entries.end();
+                shards[i].cost = 0;
+            }
+        }
+
+        // Of get() calls
+        uint64_t hits() const
+        {
+            return hitCount.load(std::memory_order_relaxed);
+        }
+
+        uint64_t misses() const
+        {
+            return missCount.load(std::memory_order_relaxed);
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////////////////////
+    // Packed records
+    //////////////////////////////////////////////////////////////////////////////////
+    namespace detail
+    {
+        // Records go through a stack block, so the bulk path stays allocation-free
+        constexpr size_t packedBlockSize = 4096;
+
+        template<typename T>
+        constexpr size_t packedRecordSize = []<size_t... I>(std::index_sequence<I...>)
+        {
+            return (sizeof(std::tuple_element_t<I, T>) + ...);
+        }(std::make_index_sequence<std::tuple_size_v<T>>());
+
+        template<typename T, size_t F>
+        constexpr size_t packedFieldOffset = []<size_t... I>(std::index_sequence<I...>)
+        {
+            return (size_t(0) + ... + sizeof(std::tuple_element_t<I, T>));
+        }(std::make_index_sequence<F>());
+
+        template<typename T, size_t... F>
+        inline void packRecords(const T* records, size_t count, char* block, std::index_sequence<F...>)
+        {
+            constexpr size_t stride = packedRecordSize<T>;
+
+            for (size_t i = 0; i < count; ++i)
+                (std::memcpy(block + i * stride + packedFieldOffset<T, F>, &std::get<F>(records[i]), sizeof(std::tuple_element_t<F, T>)), ...);
+        }
+
+        // Field-major strided loops, one per member, which compilers vectorize
+        template<typename T, size_t F>
+        inline void unpackField(T* records, size_t count, const char* block)
+        {
+            constexpr size_t stride = packedRecordSize<T>;
+
+            for (size_t i = 0; i < count; ++i)
+                std::memcpy(&std::get<F>(records[i]), block + i * stride + packedFieldOffset<T, F>, sizeof(std::tuple_element_t<F, T>));
+        }
+
+        template<typename T, size_t... F>
+        inline void unpackRecords(T* records, size_t count, const char* block, std::index_sequence<F...>)
+        {
+            (unpackField<T, F>(records, count, block), ...);
+        }
+
+        template<typename T>
+        inline void writePackedRecords(SerBin<std::ios::out>& writer, const T* records, size_t count)
+        {
+            constexpr size_t perBlock = std::max<size_t>(1, packedBlockSize / packedRecordSize<T>);
+            char block[perBlock * packedRecordSize<T>];
+
+            for (size_t done = 0; done < count; done += perBlock)
+            {
+                size_t n = std::min(perBlock, count - done);
+                packRecords(records + done, n, block, std::make_index_sequence<std::tuple_size_v<T>>());
+                writer.stream.write(block, n * packedRecordSize<T>);
+            }
+        }
+
+        template<typename T>
+        inline void readPackedRecords(SerBin<std::ios::in>& reader, T* records, size_t count)
+        {
+            constexpr size_t perBlock = std::max<size_t>(1, packedBlockSize / packedRecordSize<T>);
+            char block[perBlock * packedRecordSize<T>];
+
+            for (size_t done = 0; done < count; done += perBlock)
+            {
+                size_t n = std::min(perBlock, count - done);
+                reader.stream.read(block, n * packedRecordSize<T>);
+                unpackRecords(records + done, n, block, std::make_index_sequence<std::tuple_size_v<T>>());
+            }
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////////////////
+    // Bit packing
+    //////////////////////////////////////////////////////////////////////////////////
+    namespace detail
+    {
+        // A block is [width][exception count][ceil(n * width / 32) packed words]
+        // [exception positions][exception high bits as uint32]. The width is the
+        // cheapest one once values that don't fit are paid for as exceptions.
+        constexpr size_t bitPackBlock = 128;
+        constexpr size_t bitPackMaxBytes = 2 + bitPackBlock * 4 + bitPackBlock * 5;
+
+        template<typename T>
+        constexpr bool isBitPackable = std::is_integral_v<T> && sizeof(T) <= 4 && !std::is_same_v<T, bool>;
+
+        template<typename T>
+        inline uint32_t toPackable(T value)
+        {
+            if constexpr (std::is_signed_v<T>)
+                return (uint32_t(int32_t(value)) << 1) ^ uint32_t(int32_t(value) >> 31); // zigzag
+            else
+                return uint32_t(value);
+        }
+
+        template<typename T>
+        inline T fromPackable(uint32_t value)
+        {
+            if constexpr (std::is_signed_v<T>)
+                return T(int32_t((value >> 1) ^ (0u - (value & 1))));
+            else
+                return T(value);
+        }
+
+        // Every 32 values take exactly B words, so each group unpacks with
+        // constant word indices, shifts and masks, fully unrolled.
+        template<unsigned B, size_t... I>
+        inline void unpackGroup(const uint32_t* words, uint32_t* values, std::index_sequence<I...>)
+        {
+            constexpr uint64_t mask = (uint64_t(1) << B) - 1;
+
+            ((values[I] = uint32_t(((words[I * B / 32] | (uint64_t(words[std::min<size_t>(I * B / 32 + 1, B - 1)]) << 32)) >> (I * B % 32)) & mask)), ...);
+        }
+
+        template<unsigned B>
+        inline void unpackBlock(const uint32_t* words, uint32_t* values)
+        {
+            if constexpr (B == 0)
+            {
+                std::fill(values, values + bitPackBlock, 0u);
+            }
+            else
+            {
+                for (size_t group = 0; group < bitPackBlock / 32; ++group)
+                    unpackGroup<B>(words + group * B, values + group * 32, std::make_index_sequence<32>());
+            }
+        }
+
+        template<unsigned B, size_t I>
+        inline void packValue(const uint32_t* values, uint32_t* words)
+        {
+            constexpr size_t bit = I * B;
+            uint64_t low = values[I] & ((uint64_t(1) << B) - 1);
+
+            words[bit / 32] |= uint32_t(low << (bit % 32));
+            if constexpr (bit % 32 + B > 32)
+                words[bit / 32 + 1] |= uint32_t(low >> (32 - bit % 32));
+        }
+
+        template<unsigned B, size_t... I>
+        inline void packGroup(const uint32_t* values, uint32_t* words, std::index_sequence<I...>)
+        {
+            (packValue<B, I>(values, words), ...);
+        }
+
+        // Packs the low B bits of all bitPackBlock values into zeroed words
+        template<unsigned B>
+        inline void packBlockBits(const uint32_t* values, uint32_t* words)
+        {
+            if constexpr (B > 0)
+            {
+                for (size_t group = 0; group < bitPackBlock / 32; ++group)
+                    packGroup<B>(values + group * 32, words + group * B, std::make_index_sequence<32>());
+            }
+        }
+
+        using BlockKernel = void (*)(const uint32_t*, uint32_t*);
+
+        template<template<unsigned> typename Kernel>
+        constexpr auto kernelTable = []<unsigned... B>(std::integer_sequence<unsigned, B...>)
+        {
+            return std::array<BlockKernel, sizeof...(B)>{ &Kernel<B>::run... };
+        }(std::make_integer_sequence<unsigned, 33>());
+
+        template<unsigned B>
+        struct PackKernel
+        {
+            static void run(const uint32_t* values, uint32_t* words) { packBlockBits<B>(values, words); }
+        };
+
+        template<unsigned B>
+        struct UnpackKernel
+        {
+            static void run(const uint32_t* words, uint32_t* values) { unpackBlock<B>(words, values); }
+        };
+
+        // values holds a whole block, zero past count
+        inline size_t packBlock(const uint32_t* values, size_t count, char* out)
+        {
+            size_t widths[33] = {};
+            for (size_t i = 0; i < count; ++i)
+                ++widths[std::bit_width(values[i])];
+
+            unsigned width = 32;
+            size_t bestCost = SIZE_MAX, exceptions = 0;
+            for (int b = 32; b >= 0; --b)
+            {
+                size_t cost = (count * b + 31) / 32 * 4 + exceptions * 5;
+                if (cost <= bestCost)
+                {
+                    bestCost = cost;
+                    width = unsigned(b);
+                }
+
+                if (b > 0)
+                    exceptions += widths[b];
+            }
+
+            uint32_t words[bitPackBlock] = {};
+            kernelTable<PackKernel>[width](values, words);
+
+            size_t wordBytes = (count * width + 31) / 32 * 4;
+            size_t exceptionCount = 0;
+            char* positions = out + 2 + wordBytes;
+            std::memcpy(out + 2, words, wordBytes);
+
+            if (width < 32)
+            {
+                for (size_t i = 0; i < count; ++i)
+                {
+                    if ((values[i] >> width) != 0)
+                        positions[exceptionCount++] = char(i);
+                }
+
+                for (size_t e = 0; e < exceptionCount; ++e)
+                {
+                    uint32_t high = values[uint8_t(positions[e])] >> width;
+                    std::memcpy(positions + exceptionCount + e * 4, &high, 4);
+                }
+            }
+
+            out[0] = char(width);
+            out[1] = char(exceptionCount);
+            return 2 + wordBytes + exceptionCount * 5;
+        }
+
+        // The block packBlock sees for n values, zero past n. Delta packs the
+        // zigzagged differences between neighbours, the first one taken from
+        // zero so blocks stay independent.
+        template<Encoding E, typename T>
+        inline void toPackBlock(const T* values, size_t n, uint32_t* block)
+        {
+            static_assert(isBitPackable<T>, "Encoding::BitPacked and Encoding::Delta need integers of up to 32 bits");
+
+            if constexpr (E == Encoding::Delta)
+            {
+                uint32_t previous = 0;
+                for (size_t i = 0; i < n; ++i)
+                {
+                    uint32_t current = std::is_signed_v<T> ? uint32_t(int32_t(values[i])) : uint32_t(values[i]);
+                    block[i] = toPackable(int32_t(current - previous));
+                    previous = current;
+                }
+            }
+            else
+            {
+                for (size_t i = 0; i < n; ++i)
+                    block[i] = toPackable(values[i]);
+            }
+
+            std::fill(block + n, block + bitPackBlock, 0u);
+        }
+
+        template<Encoding E, typename T>
+        inline void writePackedBlocks(SerBin<std::ios::out>& writer, const T* values, size_t count)
+        {
+            uint32_t block[bitPackBlock];
+            char out[bitPackMaxBytes];
+
+            for (size_t done = 0; done < count; done += bitPackBlock)
+            {
+                size_t n = std::min(bitPackBlock, count - done);
+                toPackBlock<E>(values + done, n, block);
+                writer.stream.write(out, packBlock(block, n, out));
+            }
+        }
+
+        // What writePackedBlocks would write
+        template<Encoding E, typename T>
+        inline size_t packedBlocksSize(const T* values, size_t count)
+        {
+            uint32_t block[bitPackBlock];
+            char out[bitPackMaxBytes];
+            size_t size = 0;
+
+            for (size_t done = 0; done < count; done += bitPackBlock)
+            {
+                size_t n = std::min(bitPackBlock, count - done);
+                toPackBlock<E>(values + done, n, block);
+                size += packBlock(block, n, out);
+            }
+
+            return size;
+        }
+
+        // Reads one block of n values written by packBlock
+        inline bool readPackBlock(SerBin<std::ios::in>& reader, size_t n, uint32_t* block)
+        {
+            uint32_t words[bitPackBlock] = {};
+            char body[bitPackMaxBytes];
+            uint8_t header[2];
+            reader.stream.read((char*)header, 2);
+
+            unsigned width = header[0];
+            size_t exceptionCount = header[1];
+            if (!reader.stream || width > 32 || exceptionCount > n)
+            {
+                reader.stream.setstate(std::ios::failbit);
+                return false;
+            }
+
+            size_t wordBytes = (n * width + 31) / 32 * 4;
+            reader.stream.read(body, wordBytes + exceptionCount * 5);
+            std::memcpy(words, body, wordBytes);
+            kernelTable<UnpackKernel>[width](words, block);
+
+            for (size_t e = 0; e < exceptionCount; ++e)
+            {
+                uint8_t position = uint8_t(body[wordBytes + e]);
+                uint32_t high;
+                std::memcpy(&high, body + wordBytes + exceptionCount + e * 4, 4);
+
+                if (position < n && width < 32)
+                    block[position] |= high << width;
+            }
+
+            return bool(reader.stream);
+        }
+
+        template<Encoding E, typename T>
+        inline void readPackedBlocks(SerBin<std::ios::in>& reader, T* values, size_t count)
+        {
+            static_assert(isBitPackable<T>, "Encoding::BitPacked and Encoding::Delta need integers of up to 32 bits");
+            uint32_t block[bitPackBlock];
+
+            for (size_t done = 0; done < count; done += bitPackBlock)
+            {
+                size_t n = std::min(bitPackBlock, count - done);
+                if (!readPackBlock(reader, n, block))
+                    return;
+
+                if constexpr (E == Encoding::Delta)
+                {
+                    uint32_t previous = 0;
+                    for (size_t i = 0; i < n; ++i)
+                    {
+                        previous += uint32_t(fromPackable<int32_t>(block[i]));
+                        values[done + i] = T(previous);
+                    }
+                }
+                else
+                {
+                    for (size_t i = 0; i < n; ++i)
+                        values[done + i] = fromPackable<T>(block[i]);
+                }
+            }
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////////////////
+    // Reduced-precision floats
+    //////////////////////////////////////////////////////////////////////////////////
+    namespace detail
+    {
+        // Round to nearest even; NaN stays NaN, overflow becomes infinity
+        inline uint16_t floatToHalf(float value)
+        {
+            constexpr uint32_t halfOverflow = (127 + 16) << 23;
+            constexpr uint32_t halfMinNormal = 113 << 23;
+            constexpr float subnormalMagic = 0.5f;
+
+            uint32_t bits = std::bit_cast<uint32_t>(value);
+            uint32_t sign = (bits >> 16) & 0x8000;
+            bits &= 0x7FFFFFFF;
+
+            if (bits >= halfOverflow)
+                return uint16_t(sign | (bits > 0x7F800000 ? 0x7E00 : 0x7C00));
+
+            if (bits < halfMinNormal)
+            {
+                float shifted = std::bit_cast<float>(bits) + subnormalMagic;
+                return uint16_t(sign | (std::bit_cast<uint32_t>(shifted) - std::bit_cast<uint32_t>(subnormalMagic)));
+            }
+
+            bits += (uint32_t(15 - 127) << 23) + 0xFFF + ((bits >> 13) & 1);
+            return uint16_t(sign | (bits >> 13));
+        }
+
+        inline float halfToFloat(uint16_t half)
+        {
+            constexpr uint32_t shiftedExponent = 0x7C00 << 13;
+
+            uint32_t bits = uint32_t(half & 0x7FFF) << 13;
+            uint32_t exponent = bits & shiftedExponent;
+            bits += uint32_t(127 - 15) << 23;
+
+            if (exponent == shiftedExponent)
+            {
+                bits += uint32_t(128 - 16) << 23;
+            }
+            else if (exponent == 0)
+            {
+                bits += 1 << 23;
+                bits = std::bit_cast<uint32_t>(std::bit_cast<float>(bits) - std::bit_cast<float>(uint32_t(113) << 23));
+            }
+
+            return std::bit_cast<float>(bits | (uint32_t(half & 0x8000) << 16));
+        }
+
+        inline uint16_t floatToBFloat16(float value)
+        {
+            uint32_t bits = std::bit_cast<uint32_t>(value);
+            if ((bits & 0x7FFFFFFF) > 0x7F800000)
+                return uint16_t((bits >> 16) | 0x40);
+
+            return uint16_t((bits + 0x7FFF + ((bits >> 16) & 1)) >> 16);
+        }
+
+        inline float bfloat16ToFloat(uint16_t value)
+        {
+            return std::bit_cast<float>(uint32_t(value) << 16);
+        }
+
+        template<typename T>
+        inline void toHalves(const T* values, uint16_t* halves, size_t count)
+        {
+            size_t i = 0;
+#ifdef SERBIN_F16C
+            if constexpr (std::is_same_v<T, float>)
+            {
+                for (; i + 8 <= count; i += 8)
+                    _mm_storeu_si128((__m128i*)(halves + i), _mm256_cvtps_ph(_mm256_loadu_ps(values + i), _MM_FROUND_TO_NEAREST_INT));
+            }
+#endif
+            for (; i < count; ++i)
+                halves[i] = floatToHalf(float(values[i]));
+        }
+
+        template<typename T>
+        inline void fromHalves(const uint16_t* halves, T* values, size_t count)
+        {
+            size_t i = 0;
+#ifdef SERBIN_F16C
+            if constexpr (std::is_same_v<T, float>)
+            {
+                for (; i + 8 <= count; i += 8)
+                    _mm256_storeu_ps(values + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(halves + i))));
+            }
+#endif
+            for (; i < count; ++i)
+                values[i] = T(halfToFloat(halves[i]));
+        }
+
+        // Straight-line loops, which compilers vectorize without intrinsics
+        template<typename T>
+        inline void toBFloat16s(const T* values, uint16_t* halves, size_t count)
+        {
+            for (size_t i = 0; i < count; ++i)
+                halves[i] = floatToBFloat16(float(values[i]));
+        }
+
+        template<typename T>
+        inline void fromBFloat16s(const uint16_t* halves, T* values, size_t count)
+        {
+            for (size_t i = 0; i < count; ++i)
+                values[i] = T(bfloat16ToFloat(halves[i]));
+        }
+
+        constexpr size_t halfBlock = 2048;
+        constexpr size_t quantizedBlock = 256;
+
+        template<Encoding E, typename T>
+        inline void writeHalves(SerBin<std::ios::out>& writer, const T* values, size_t count)
+        {
+            static_assert(std::is_floating_point_v<T>, "Reduced-precision encodings need floating point values");
+            uint16_t halves[halfBlock];
+
+            for (size_t done = 0; done < count; done += halfBlock)
+            {
+                size_t n = std::min(halfBlock, count - done);
+                if constexpr (E == Encoding::Float16)
+                    toHalves(values + done, halves, n);
+                else
+                    toBFloat16s(values + done, halves, n);
+
+                writer.stream.write((const char*)halves, n * sizeof(uint16_t));
+            }
+        }
+
+        template<Encoding E, typename T>
+        inline void readHalves(SerBin<std::ios::in>& reader, T* values, size_t count)
+        {
+            static_assert(std::is_floating_point_v<T>, "Reduced-precision encodings need floating point values");
+            uint16_t halves[halfBlock];
+
+            for (size_t done = 0; done < count; done += halfBlock)
+            {
+                size_t n = std::min(halfBlock, count - done);
+                reader.stream.read((char*)halves, n * sizeof(uint16_t));
+
+                if constexpr (E == Encoding::Float16)
+                    fromHalves(halves, values + done, n);
+                else
+                    fromBFloat16s(halves, values + done, n);
+            }
+        }
+
+        // NaN has no int8 to become, so it is stored as 0; infinities saturate
+        inline int8_t quantize(float value, float inverse)
+        {
+            if (std::isnan(value))
+                return 0;
+            if (std::isinf(value))
+                return value > 0 ? 127 : -127;
+
+            return int8_t(std::clamp(std::nearbyint(value * inverse), -127.f, 127.f));
+        }
+
+        // Each block is [float scale][int8 per value], value ~= q * scale, with the
+        // scale set so the block's largest finite magnitude maps to 127
+        template<typename T>
+        inline void writeQuantized(SerBin<std::ios::out>& writer, const T* values, size_t count)
+        {
+            static_assert(std::is_floating_point_v<T>, "Reduced-precision encodings need floating point values");
+            char out[sizeof(float) + quantizedBlock];
+
+            for (size_t done = 0; done < count; done += quantizedBlock)
+            {
+                size_t n = std::min(quantizedBlock, count - done);
+                float largest = 0;
+                for (size_t i = 0; i < n; ++i)
+                {
+                    float magnitude = std::abs(float(values[done + i]));
+                    if (std::isfinite(magnitude))
+                        largest = std::max(largest, magnitude);
+                }
+
+                float scale = largest / 127;
+                float inverse = scale > 0 ? 1 / scale : 0;
+                std::memcpy(out, &scale, sizeof(float));
+
+                for (size_t i = 0; i < n; ++i)
+                    out[sizeof(float) + i] = char(quantize(float(values[done + i]), inverse));
+
+                writer.stream.write(out, sizeof(float) + n);
+            }
+        }
+
+        template<typename T>
+        inline void readQuantized(SerBin<std::ios::in>& reader, T* values, size_t count)
+        {
+            static_assert(std::is_floating_point_v<T>, "Reduced-precision encodings need floating point values");
+            char in[sizeof(float) + quantizedBlock];
+
+            for (size_t done = 0; done < count; done += quantizedBlock)
+            {
+                size_t n = std::min(quantizedBlock, count - done);
+                reader.stream.read(in, sizeof(float) + n);
+
+                float scale;
+                std::memcpy(&scale, in, sizeof(float));
+
+                for (size_t i = 0; i < n; ++i)
+                    values[done + i] = T(int8_t(in[sizeof(float) + i]) * scale);
+            }
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////////////////
+    // Encodings
+    //////////////////////////////////////////////////////////////////////////////////
+    namespace detail
+    {
+        // Runs restart every runLengthBlock values, so slices on those
+        // boundaries write the same bytes as the whole array
+        constexpr size_t runLengthBlock = 4096;
+
+        template<typename T>
+        inline size_t runEnd(const T* values, size_t begin, size_t count)
+        {
+            size_t end = std::min(count, (begin / runLengthBlock + 1) * runLengthBlock);
+            size_t i = begin + 1;
+            while (i < end && std::memcmp(values + i, values + begin, sizeof(T)) == 0)
+                ++i;
+
+            return i;
+        }
+
+        template<typename T>
+        inline void writeRunLengths(SerBin<std::ios::out>& writer, const T* values, size_t count)
+        {
+            constexpr size_t runBytes = sizeof(uint16_t) + sizeof(T);
+            char out[64 * runBytes];
+            size_t used = 0;
+
+            for (size_t i = 0, end; i < count; i = end)
+            {
+                end = runEnd(values, i, count);
+                uint16_t length = uint16_t(end - i - 1);
+                std::memcpy(out + used, &length, sizeof(length));
+                std::memcpy(out + used + sizeof(length), values + i, sizeof(T));
+
+                if ((used += runBytes) == sizeof(out))
+                {
+                    writer.stream.write(out, used);
+                    used = 0;
+                }
+            }
+
+            writer.stream.write(out, used);
+        }
+
+        template<typename T>
+        inline void readRunLengths(SerBin<std::ios::in>& reader, T* values, size_t count)
+        {
+            char in[sizeof(uint16_t) + sizeof(T)];
+
+            for (size_t i = 0; i < count;)
+            {
+                reader.stream.read(in, sizeof(in));
+                uint16_t length;
+                std::memcpy(&length, in, sizeof(length));
+
+                size_t blockEnd = std::min(count, (i / runLengthBlock + 1) * runLengthBlock);
+                if (!reader.stream || length >= blockEnd - i)
+                {
+                    reader.stream.setstate(std::ios::failbit);
+                    return;
+                }
+
+                T value;
+                std::memcpy(&value, in + sizeof(length), sizeof(T));
+                std::fill_n(values + i, length + 1, value);
+                i += length + 1;
+            }
+        }
+
+        // The lossless encodings Encoding::Adaptive chooses from
+        template<typename T>
+        inline bool adaptiveCandidate(Encoding encoding)
+        {
+            switch (encoding)
+            {
+            case Encoding::Raw:
+            case Encoding::RunLength:
+                return true;
+            case Encoding::BitPacked:
+            case Encoding::Delta:
+                return isBitPackable<T>;
+            default:
+                return false;
+            }
+        }
+
+        template<typename T>
+        inline size_t encodedSize(Encoding encoding, const T* values, size_t count)
+        {
+            if constexpr (isBitPackable<T>)
+            {
+                if (encoding == Encoding::BitPacked)
+                    return packedBlocksSize<Encoding::BitPacked>(values, count);
+                if (encoding == Encoding::Delta)
+                    return packedBlocksSize<Encoding::Delta>(values, count);
+            }
+
+            if (encoding != Encoding::RunLength)
+                return sizeof(T) * count;
+
+            size_t runs = 0;
+            for (size_t i = 0; i < count; i = runEnd(values, i, count))
+                ++runs;
+
+            return runs * (sizeof(uint16_t) + sizeof(T));
+        }
+
+        // Trial-encodes a few spread-out chunks (or everything, if small) and
+        // weighs each candidate's size relative to Raw against a rough
+        // relative decoding cost
+        template<typename T>
+        inline Encoding chooseEncoding(const T* values, size_t count, float speed)
+        {
+            constexpr size_t chunk = 512, chunks = 8;
+            constexpr Encoding candidates[] = { Encoding::Raw, Encoding::RunLength, Encoding::BitPacked, Encoding::Delta };
+            constexpr float decodeCost[] = { 0.0f, 0.4f, 0.5f, 0.6f };
+
+            if (count < 64 || speed >= 1.0f)
+                return Encoding::Raw;
+
+            size_t sizes[std::size(candidates)] = {};
+            bool sampled = count > chunk * chunks;
+            for (size_t c = 0; c < (sampled ? chunks : 1); ++c)
+            {
+                size_t begin = sampled ? (count - chunk) * c / (chunks - 1) / bitPackBlock * bitPackBlock : 0;
+                size_t n = sampled ? chunk : count;
+
+                for (size_t e = 0; e < std::size(candidates); ++e)
+                {
+                    if (adaptiveCandidate<T>(candidates[e]))
+                        sizes[e] += encodedSize(candidates[e], values + begin, n);
+                }
+            }
+
+            Encoding best = Encoding::Raw;
+            float bestCost = 1.0f - speed;
+            for (size_t e = 1; e < std::size(candidates); ++e)
+            {
+                float cost = (1.0f - speed) * float(sizes[e]) / float(sizes[0]) + speed * decodeCost[e];
+                if (adaptiveCandidate<T>(candidates[e]) && cost < bestCost)
+                {
+                    best = candidates[e];
+                    bestCost = cost;
+                }
+            }
+
+            return best;
+        }
+
+        // The lossless encodings, picked at run time
+        template<typename T>
+        inline void writeEncodedAs(Encoding encoding, SerBin<std::ios::out>& writer, const T* values, size_t count)
+        {
+            if constexpr (isBitPackable<T>)
+            {
+                if (encoding == Encoding::BitPacked)
+                    return writePackedBlocks<Encoding::BitPacked>(writer, values, count);
+                if (encoding == Encoding::Delta)
+                    return writePackedBlocks<Encoding::Delta>(writer, values, count);
+            }
+
+            if (encoding == Encoding::RunLength)
+                writeRunLengths(writer, values, count);
+            else if (count > 0)
+                writer.stream.write((const char*)values, sizeof(T) * count);
+        }
+
+        template<typename T>
+        inline void readEncodedAs(Encoding encoding, SerBin<std::ios::in>& reader, T* values, size_t count)
+        {
+            if constexpr (isBitPackable<T>)
+            {
+                if (encoding == Encoding::BitPacked)
+                    return readPackedBlocks<Encoding::BitPacked>(reader, values, count);
+                if (encoding == Encoding::Delta)
+                    return readPackedBlocks<Encoding::Delta>(reader, values, count);
+            }
+
+            if (encoding == Encoding::RunLength)
+                readRunLengths(reader, values, count);
+            else if (count > 0)
+                reader.stream.read((char*)values, sizeof(T) * count);
+        }
+
+        // Adaptive's tag byte, only written for a non-empty array
+        inline void writeEncodingTag(SerBin<std::ios::out>& writer, Encoding encoding)
+        {
+            writer.stream.put(char(encoding));
+        }
+
+        template<typename T>
+        inline Encoding readEncodingTag(SerBin<std::ios::in>& reader)
+        {
+            Encoding encoding = Encoding(uint8_t(reader.stream.get()));
+            if (!reader.stream || !adaptiveCandidate<T>(encoding))
+            {
+                reader.stream.setstate(std::ios::failbit);
+                return Encoding::Raw;
+            }
+
+            return encoding;
+        }
+
+        template<Encoding E, typename T>
+        inline void writeEncoded(SerBin<std::ios::out>& writer, const T* values, size_t count)
+        {
+            if constexpr (E == Encoding::BitPacked || E == Encoding::Delta)
+            {
+                writePackedBlocks<E>(writer, values, count);
+            }
+            else if constexpr (E == Encoding::Float16 || E == Encoding::BFloat16)
+            {
+                writeHalves<E>(writer, values, count);
+            }
+            else if constexpr (E == Encoding::QuantizedInt8)
+            {
+                writeQuantized(writer, values, count);
+            }
+            else if constexpr (E == Encoding::RunLength)
+            {
+                writeRunLengths(writer, values, count);
+            }
+            else if constexpr (E == Encoding::Adaptive)
+            {
+                if (count == 0)
+                    return;
+
+                Encoding chosen = chooseEncoding(values, count, adaptiveSpeed<T>);
+                writeEncodingTag(writer, chosen);
+                writeEncodedAs(chosen, writer, values, count);
+            }
+            else if (count > 0)
+            {
+                writer.stream.write((const char*)values, sizeof(T) * count);
+            }
+        }
+
+        template<Encoding E, typename T>
+        inline void readEncoded(SerBin<std::ios::in>& reader, T* values, size_t count)
+        {
+            if constexpr (E == Encoding::BitPacked || E == Encoding::Delta)
+            {
+                readPackedBlocks<E>(reader, values, count);
+            }
+            else if constexpr (E == Encoding::Float16 || E == Encoding::BFloat16)
+            {
+                readHalves<E>(reader, values, count);
+            }
+            else if constexpr (E == Encoding::QuantizedInt8)
+            {
+                readQuantized(reader, values, count);
+            }
+            else if constexpr (E == Encoding::RunLength)
+            {
+                readRunLengths(reader, values, count);
+            }
+            else if constexpr (E == Encoding::Adaptive)
+            {
+                if (count == 0)
+                    return;
+
+                Encoding chosen = readEncodingTag<T>(reader);
+                if (reader.stream)
+                    readEncodedAs(chosen, reader, values, count);
+            }
+            else if (count > 0)
+            {
+                reader.stream.read((char*)values, sizeof(T) * count);
+            }
+        }
+    }
+
+    // Fundamental types and opt-in PODs
+    template<typename T, typename = std::enable_if_t<serializeAsPOD<T>>>
+    inline SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const T& object)
+    {
+        writer.stream.write((const char*)(&object), sizeof(T));
+        return writer;
+    }
+
+    template<typename T, typename = std::enable_if_t<serializeAsPOD<T>>>
+    inline SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, T& object)
+    {
+        reader.stream.read((char*)(&object), sizeof(T));
+        return reader;
+    }
+
+    // Smart pointers
+    template<typename T>
+    inline SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const std::unique_ptr<T>& object)
+    {
+        writer << bool(object);
+
+        if (object)
+            writer << *object;
+
+        return writer;
+    }
+
+    template<typename T>
+    inline SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, std::unique_ptr<T>& object)
+    {
+        bool hasValue;
+        reader >> hasValue;
+
+        if (hasValue)
+        {
+            object = std::make_unique<T>();
+            reader >> *object;
+        }
+
+        return reader;
+    }
+
+    template<typename T>
+    inline SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const std::shared_ptr<T>& object)
+    {
+        writer << bool(object);
+
+        if (object)
+            writer << *object;
+
+        return writer;
+    }
+
+    template<typename T>
+    inline SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, std::shared_ptr<T>& object)
+    {
+        bool hasValue;
+        reader >> hasValue;
+
+        if (hasValue)
+        {
+            object = std::make_shared<T>();
+            reader >> *object;
+        }
+
+        return reader;
+    }
+
+    // std::string, std::wstring etc
+    template<typename T>
+    inline SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const std::basic_string<T>& object)
+    {
+        writer << object.size();
+
+        if (object.size() > 0)
+            writer.stream.write((const char*)(object.data()), object.size() * sizeof(T));
+
+        return writer;
+    }
+
+    template<typename T>
+    inline SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, std::basic_string<T>& object)
+    {
+        decltype(object.size()) s;
+        reader >> s;
+
+        if (s > 0)
+        {
+            object.resize(s);
+            reader.stream.read((char*)(object.data()), object.size() * sizeof(T));
+        }
+
+        return reader;
+    }
+
+    // std::vector
+    template<typename T>
+    inline SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const std::vector<T>& object)
+    {
+        writer << object.size();
+        if constexpr (serializeAsPOD<T>)
+        {
+            detail::writeEncoded<encodeAs<T>>(writer, object.data(), object.size());
+        }
+        else if constexpr (serializeAsPackedRecord<T>)
+        {
+            detail::writePackedRecords(writer, object.data(), object.size());
+        }
+        else
+        {
+            for (auto&& value : object)
+                writer << value;
+        }
+
+        return writer;
+    }
+
+    template<typename T>
+    inline SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, std::vector<T>& object)
+    {
+        decltype(object.size()) s;
+        reader >> s;
+
+        if (s == 0)
+            return reader;
+
+        object.resize(s);
+
+        if constexpr (serializeAsPOD<T>)
+        {
+            detail::readEncoded<encodeAs<T>>(reader, object.data(), s);
+        }
+        else if constexpr (serializeAsPackedRecord<T>)
+        {
+            detail::readPackedRecords(reader, object.data(), s);
+        }
+        else
+        {
+            for (auto&& value : object)
+                reader >> value;
+        }
+
+        return reader;
+    }
+
+    // std::array
+    template<typename T, size_t N>
+    inline SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const std::array<T, N>& object)
+    {
+        if constexpr (N > 0)
+        {
+            if constexpr (serializeAsPOD<T>)
+            {
+                detail::writeEncoded<encodeAs<T>>(writer, object.data(), N);
+            }
+            else if constexpr (serializeAsPackedRecord<T>)
+            {
+                detail::writePackedRecords(writer, object.data(), N);
+            }
+            else
+            {
+                for (auto&& value : object)
+                    writer << value;
+            }
+        }
+
+        return writer;
+    }
+
+    template<typename T, size_t N>
+    inline SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, std::array<T, N>& object)
+    {
+        if constexpr (N > 0)
+        {
+            if constexpr (serializeAsPOD<T>)
+            {
+                detail::readEncoded<encodeAs<T>>(reader, object.data(), N);
+            }
+            else if constexpr (serializeAsPackedRecord<T>)
+            {
+                detail::readPackedRecords(reader, object.data(), N);
+            }
+            else
+            {
+                for (auto&& value : object)
+                    reader >> value;
+            }
+        }
+
+        return reader;
+    }
+
+    // std::list
+    template<typename T>
+    inline SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const std::list<T>& object)
+    {
+        writer << object.size();
+
+        for (auto&& value : object)
+            writer << value;
+
+        return writer;
+    }
+
+    template<typename T>
+    inline SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, std::list<T>& object)
+    {
+        decltype(object.size()) s;
+        reader >> s;
+
+        for (decltype(s) i = 0; i < s; ++i)
+        {
+            object.push_back(T());
+            reader >> object.back();
+        }
+
+        return reader;
+    }
+
+    // std::deque
+    template<typename T>
+    inline SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const std::deque<T>& object)
+    {
+        writer << object.size();
+
+        for (auto&& value : object)
+            writer << value;
+
+        return writer;
+    }
+
+    template<typename T>
+    inline SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, std::deque<T>& object)
+    {
+        decltype(object.size()) s;
+        reader >> s;
+
+        for (decltype(s) i = 0; i < s; ++i)
+        {
+            object.push_back(T());
+            reader >> object.back();
+        }
+
+        return reader;
+    }
+
+    // std::set
+    template<typename T>
+    inline SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const std::set<T>& object)
+    {
+        writer << object.size();
+
+        for (auto&& value : object)
+            writer << value;
+
+        return writer;
+    }
+
+    template<typename T>
+    inline SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, std::set<T>& object)
+    {
+        decltype(object.size()) s;
+        reader >> s;
+
+        for (decltype(s) i = 0; i < s; ++i)
+        {
+            T value;
+            reader >> value;
+            object.insert(std::move(value));
+        }
+
+        return reader;
+    }
+
+    // std::unordered_set
+    template<typename T>
+    inline SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const std::unordered_set<T>& object)
+    {
+        writer << object.size();
+
+        for (auto&& value : object)
+            writer << value;
+
+        return writer;
+    }
+
+    template<typename T>
+    inline SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, std::unordered_set<T>& object)
+    {
+        decltype(object.size()) s;
+        reader >> s;
+
+        for (decltype(s) i = 0; i < s; ++i)
+        {
+            T value;
+            reader >> value;
+            object.insert(std::move(value));
+        }
+
+        return reader;
+    }
+
+    // std::pair
+    template<typename T0, typename T1>
+    inline SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const std::pair<T0, T1>& object)
+    {
+        writer << object.first << object.second;
+        return writer;
+    }
+
+    template<typename T0, typename T1>
+    inline SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, std::pair<T0, T1>& object)
+    {
+        reader >> object.first >> object.second;
+        return reader;
+    }
+
+    // std::map
+    template<typename K, typename V>
+    inline SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const std::map<K, V>& object)
+    {
+        writer << object.size();
+
+        for (auto&& kv : object)
+            writer << kv;
+
+        return writer;
+    }
+
+    template<typename K, typename V>
+    inline SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, std::map<K, V>& object)
+    {
+        decltype(object.size()) s;
+        reader >> s;
+
+        for (decltype(s) i = 0; i < s; ++i)
+        {
+            std::pair<K, V> kv;
+            reader >> kv;
+            object.emplace(std::move(kv));
+        }
+
+        return reader;
+    }
+
+    // std::unordered_map
+    template<typename K, typename V>
+    inline SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const std::unordered_map<K, V>& object)
+    {
+        writer << object.size();
+
+        for (auto&& kv : object)
+            writer << kv;
+
+        return writer;
+    }
+
+    template<typename K, typename V>
+    inline SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, std::unordered_map<K, V>& object)
+    {
+        decltype(object.size()) s;
+        reader >> s;
+
+        for (decltype(s) i = 0; i < s; ++i)
+        {
+            std::pair<K, V> kv;
+            reader >> kv;
+            object.emplace(std::move(kv));
+        }
+
+        return reader;
+    }
+
+    // std::tuple
+    template<int id = 0, typename... Ts>
+    inline SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const std::tuple<Ts...>& object)
+    {
+        if constexpr (id < std::tuple_size_v<std::tuple<Ts...>>)
+        {
+            writer << std::get<id>(object);
+            operator<<<id + 1>(writer, object);
+        }
+
+        return writer;
+    }
+
+    template<int id = 0, typename... Ts>
+    inline SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, std::tuple<Ts...>& object)
+    {
+        if constexpr (id < std::tuple_size_v<std::tuple<Ts...>>)
+        {
+            reader >> std::get<id>(object);
+            operator>><id + 1>(reader, object);
+        }
+
+        return reader;
+    }
+
+    // std::optional
+    template<typename T>
+    inline SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const std::optional<T>& object)
+    {
+        bool hasValue = bool(object);
+        writer << hasValue;
+
+        if (hasValue)
+            writer << *object;
+
+        return writer;
+    }
+
+    template<typename T>
+    inline SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, std::optional<T>& object)
+    {
+        bool hasValue;
+        reader >> hasValue;
+
+        if (hasValue)
+        {
+            object = T();
+            reader >> *object;
+        }
+
+        return reader;
+    }
+
+    // Per-call encodings
+    namespace detail
+    {
+        // Same bytes as a std::vector<T> with encodeAs<T> == E
+        template<Encoding E, typename T>
+        inline void writeEncodedContainer(SerBin<std::ios::out>& writer, const std::vector<T>& object)
+        {
+            writer << object.size();
+            writeEncoded<E>(writer, object.data(), object.size());
+        }
+
+        template<Encoding E, typename T>
+        inline void readEncodedContainer(SerBin<std::ios::in>& reader, std::vector<T>& object)
+        {
+            decltype(object.size()) s;
+            reader >> s;
+
+            if (!reader.stream)
+                return;
+
+            object.resize(s);
+            readEncoded<E>(reader, object.data(), s);
+        }
+    }
+
+    template<Encoding E, typename C>
+    inline SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const Encoded<E, C>& object)
+    {
+        detail::writeEncodedContainer<E>(writer, std::as_const(object.container));
+        return writer;
+    }
+
+    template<Encoding E, typename C>
+    inline SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, Encoded<E, C> object)
+    {
+        static_assert(!std::is_const_v<C>, "Reading needs a mutable container");
+        detail::readEncodedContainer<E>(reader, object.container);
+        return reader;
+    }
+
+    //////////////////////////////////////////////////////////////////////////////////
+    // Incremental encode and decode
+    //////////////////////////////////////////////////////////////////////////////////
+    // How much one step may do. A step stops after the first element (or
+    // slice of a vector of PODs) that reaches either limit. The byte limit
+    // needs a stream that reports its position, e.g. a file or MemoryBuffer.
+    struct SliceBudget
+    {
+        std::chrono::steady_clock::duration time = std::chrono::steady_clock::duration::max();
+        uint64_t bytes = UINT64_MAX;
+    };
+
+    namespace detail
+    {
+        // Encoded blocks are independent, so slices on block boundaries
+        // write the same bytes as the whole vector
+        template<typename T>
+        constexpr size_t sliceElements = []
+        {
+            constexpr Encoding E = encodeAs<T>;
+            size_t quantum = E == Encoding::BitPacked || E == Encoding::Delta ? bitPackBlock
+                : E == Encoding::QuantizedInt8 ? quantizedBlock
+                : E == Encoding::RunLength || E == Encoding::Adaptive ? runLengthBlock : 1;
+            size_t elements = std::max<size_t>(1, packedBlockSize / sizeof(T));
+            return (elements + quantum - 1) / quantum * quantum;
+        }();
+
+        // std::array is written without a size prefix and never resized
+        template<typename C>
+        constexpr bool hasFixedSize = false;
+
+        template<typename T, size_t N>
+        constexpr bool hasFixedSize<std::array<T, N>> = true;
+
+        // Runs unit() until it reports nothing left or the budget is spent
+        template<typename Position, typename Unit>
+        inline void runSliced(const SliceBudget& budget, Position position, Unit unit)
+        {
+            auto start = std::chrono::steady_clock::now();
+            std::streamoff first = budget.bytes != UINT64_MAX ? std::streamoff(position()) : -1;
+
+            while (unit())
+            {
+                if (std::chrono::steady_clock::now() - start >= budget.time)
+                    return;
+                if (first >= 0 && uint64_t(std::streamoff(position()) - first) >= budget.bytes)
+                    return;
+            }
+        }
+    }
+
+    // Writes one big container over many calls, e.g. a slice per frame, with
+    // the same bytes as writer << container. Progress is kept here between
+    // calls; the container must not change until finished().
+    template<typename C>
+    class IncrementalWriter
+    {
+        const C& container;
+        typename C::const_iterator next;
+        size_t done = 0;
+        bool started = false;
+        Encoding chosen = Encoding::Raw;
+
+    public:
+        explicit IncrementalWriter(const C& container)
+            : container(container), next(container.begin())
+        {
+        }
+
+        // True once everything is written, or the stream failed
+        bool step(SerBin<std::ios::out>& writer, const SliceBudget& budget = {})
+        {
+            detail::runSliced(budget, [&] { return writer.stream.tellp(); }, [&]
+            {
+                if (!started)
+                {
+                    if constexpr (!detail::hasFixedSize<C>)
+                        writer << container.size();
+                    started = true;
+
+                    // Adaptive chooses once for the whole container
+                    if constexpr (requires { container.data(); } && serializeAsPOD<typename C::value_type>)
+                    {
+                        if (encodeAs<typename C::value_type> == Encoding::Adaptive && !container.empty())
+                        {
+                            chosen = detail::chooseEncoding(container.data(), container.size(), adaptiveSpeed<typename C::value_type>);
+                            detail::writeEncodingTag(writer, chosen);
+                        }
+                    }
+                }
+                else if constexpr (requires { container.data(); } && serializeAsPOD<typename C::value_type>)
+                {
+                    using T = typename C::value_type;
+                    size_t n = std::min(detail::sliceElements<T>, container.size() - done);
+                    if constexpr (encodeAs<T> == Encoding::Adaptive)
+                        detail::writeEncodedAs(chosen, writer, container.data() + done, n);
+                    else
+                        detail::writeEncoded<encodeAs<T>>(writer, container.data() + done, n);
+                    done += n;
+                }
+                else if (done < container.size())
+                {
+                    writer << *next++;
+                    ++done;
+                }
+
+                return writer.stream && done < container.size();
+            });
+
+            return finished() || !writer.stream;
+        }
+
+        bool finished() const
+        {
+            return started && done == container.size();
+        }
+
+        // Elements written so far
+        size_t position() const
+        {
+            return done;
+        }
+    };
+
+    // Reads into a container over many calls, as reader >> container would
+    template<typename C>
+    class IncrementalReader
+    {
+        C& container;
+        size_t size = 0;
+        size_t done = 0;
+        bool started = false;
+        Encoding chosen = Encoding::Raw;
+
+    public:
+        explicit IncrementalReader(C& container)
+            : container(container)
+        {
+        }
+
+        // True once everything is read, or the stream failed
+        bool step(SerBin<std::ios::in>& reader, const SliceBudget& budget = {})
+        {
+            using T = typename C::value_type;
+
+            detail::runSliced(budget, [&] { return reader.stream.tellg(); }, [&]
+            {
+                if (!started)
+                {
+                    if constexpr (detail::hasFixedSize<C>)
+                        size = container.size();
+                    else
+                        reader >> size;
+                    started = true;
+
+                    if constexpr (requires { container.data(); })
+                    {
+                        if constexpr (!detail::hasFixedSize<C>)
+                        {
+                            if (reader.stream && size > 0)
+                                container.resize(size);
+                        }
+                        if (serializeAsPOD<T> && encodeAs<T> == Encoding::Adaptive && reader.stream && size > 0)
+                            chosen = detail::readEncodingTag<T>(reader);
+                    }
+                }
+                else if constexpr (requires { container.data(); })
+                {
+                    size_t n = std::min(serializeAsPOD<T> ? detail::sliceElements<T> : 1, size - done);
+                    if constexpr (serializeAsPOD<T> && encodeAs<T> == Encoding::Adaptive)
+                        detail::readEncodedAs(chosen, reader, container.data() + done, n);
+                    else if constexpr (serializeAsPOD<T>)
+                        detail::readEncoded<encodeAs<T>>(reader, container.data() + done, n);
+                    else
+                        reader >> container[done];
+                    done += n;
+                }
+                else if constexpr (requires { container.push_back(T()); })
+                {
+                    container.push_back(T());
+                    reader >> container.back();
+                    ++done;
+                }
+                else if constexpr (requires { typename C::mapped_type; })
+                {
+                    std::pair<typename C::key_type, typename C::mapped_type> kv;
+                    reader >> kv;
+                    container.emplace(std::move(kv));
+                    ++done;
+                }
+                else
+                {
+                    T value;
+                    reader >> value;
+                    container.insert(std::move(value));
+                    ++done;
+                }
+
+                return reader.stream && done < size;
+            });
+
+            return finished() || !reader.stream;
+        }
+
+        bool finished() const
+        {
+            return started && done == size;
+        }
+
+        // Elements read so far
+        size_t position() const
+        {
+            return done;
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////////////////////
+    // Pointer graphs
+    //////////////////////////////////////////////////////////////////////////////////
+    // Raw links between arena-allocated nodes. List a node type's pointer members
+    // (T*, or arrays of T*) here, e.g.
+    //   template<> constexpr auto serbin::pointerMembers<Node> = std::tuple(&Node::left, &Node::right);
+    template<typename T>
+    constexpr auto pointerMembers = std::tuple<>();
+
+    namespace detail
+    {
+        // Its address identifies T at runtime
+        template<typename T>
+        inline constexpr char arenaTag = 0;
+    }
+
+    // Arrays of trivially copyable nodes whose pointer members link into one
+    // another. Written as the node bytes with every pointer replaced by a
+    // graph-wide node index (0 for null); read back as one bulk read per arena
+    // followed by a single sweep turning indices back into pointers.
+    //
+    // Register the same arenas in the same order on both sides, after they're
+    // built for writing. A pointer outside every arena fails the write; a stored
+    // index that doesn't resolve to a node of the right type fails the read.
+    class PointerGraph
+    {
+        struct Arena
+        {
+            char* nodes;
+            size_t count;
+            size_t nodeSize;
+            size_t first; // Graph-wide index of nodes[0]
+            const void* type;
+            void* vector; // Resized on read, or null for a fixed range
+            void (*resize)(Arena& arena, size_t count);
+            void (*write)(const PointerGraph& graph, SerBin<std::ios::out>& writer, const Arena& arena);
+            bool (*swizzle)(const PointerGraph& graph, Arena& arena);
+        };
+
+        std::vector<Arena> arenas;
+        std::vector<size_t> byAddress;
+
+        template<typename U>
+        uintptr_t indexOf(const U* pointer) const
+        {
+            if (pointer == nullptr)
+                return 0;
+
+            auto at = (uintptr_t)pointer;
+            auto next = std::upper_bound(byAddress.begin(), byAddress.end(), at, [&](uintptr_t address, size_t i)
+            {
+                return address < (uintptr_t)arenas[i].nodes;
+            });
+
+            if (next == byAddress.begin())
+                return ~uintptr_t(0);
+
+            const Arena& arena = arenas[*(next - 1)];
+            uintptr_t offset = at - (uintptr_t)arena.nodes;
+
+            if (arena.type != &detail::arenaTag<U> || offset >= arena.count * sizeof(U) || offset % sizeof(U) != 0)
+                return ~uintptr_t(0);
+
+            return arena.first + offset / sizeof(U) + 1;
+        }
+
+        template<typename U>
+        bool pointerAt(uintptr_t index, U*& pointer) const
+        {
+            pointer = nullptr;
+
+            if (index-- == 0)
+                return true;
+
+            auto next = std::upper_bound(arenas.begin(), arenas.end(), index, [](uintptr_t i, const Arena& arena)
+            {
+                return i < arena.first;
+            });
+
+            if (next == arenas.begin())
+                return false;
+
+            const Arena& arena = *(next - 1);
+
+            if (arena.type != &detail::arenaTag<std::remove_cv_t<U>> || index - arena.first >= arena.count)
+                return false;
+
+            pointer = (U*)arena.nodes + (index - arena.first);
+            return true;
+        }
+
+        template<typename M>
+        bool encodeSlot(M& slot) const
+        {
+            if constexpr (std::is_array_v<M>)
+            {
+                bool ok = true;
+                for (auto& element : slot)
+                    ok &= encodeSlot(element);
+                return ok;
+            }
+            else
+            {
+                static_assert(std::is_pointer_v<M> && sizeof(M) == sizeof(uintptr_t), "pointerMembers must name T* or T*[N] members");
+                uintptr_t index = indexOf<std::remove_cv_t<std::remove_pointer_t<M>>>(slot);
+                std::memcpy(&slot, &index, sizeof(index));
+                return index != ~uintptr_t(0);
+            }
+        }
+
+        template<typename M>
+        bool decodeSlot(M& slot) const
+        {
+            if constexpr (std::is_array_v<M>)
+            {
+                bool ok = true;
+                for (auto& element : slot)
+                    ok &= decodeSlot(element);
+                return ok;
+            }
+            else
+            {
+                uintptr_t index;
+                std::memcpy(&index, &slot, sizeof(index));
+                return pointerAt(index, slot);
+            }
+        }
+
+        template<typename T>
+        static void writeArena(const PointerGraph& graph, SerBin<std::ios::out>& writer, const Arena& arena)
+        {
+            constexpr size_t perBlock = std::max<size_t>(1, detail::packedBlockSize / sizeof(T));
+            alignas(T) char block[perBlock * sizeof(T)];
+            T* staged = (T*)block;
+
+            for (size_t done = 0; done < arena.count && writer.stream; done += perBlock)
+            {
+                size_t n = std::min(perBlock, arena.count - done);
+                std::memcpy(block, arena.nodes + done * sizeof(T), n * sizeof(T));
+
+                bool ok = true;
+                for (size_t i = 0; i < n; ++i)
+                    std::apply([&](auto... member) { ((ok &= graph.encodeSlot(staged[i].*member)), ...); }, pointerMembers<T>);
+
+                if (!ok)
+                    writer.stream.setstate(std::ios::badbit);
+                else
+                    writer.stream.write(block, n * sizeof(T));
+            }
+        }
+
+        template<typename T>
+        static bool swizzleArena(const PointerGraph& graph, Arena& arena)
+        {
+            T* nodes = (T*)arena.nodes;
+            bool ok = true;
+
+            for (size_t i = 0; i < arena.count; ++i)
+                std::apply([&](auto... member) { ((ok &= graph.decodeSlot(nodes[i].*member)), ...); }, pointerMembers<T>);
+
+            return ok;
+        }
+
+        template<typename T>
+        static void resizeVector(Arena& arena, size_t count)
+        {
+            auto& nodes = *(std::vector<T>*)arena.vector;
+            nodes.resize(count);
+            arena.nodes = (char*)nodes.data();
+            arena.count = count;
+        }
+
+        template<typename T>
+        PointerGraph& add(T* nodes, size_t count, std::vector<T>* vector)
+        {
+            static_assert(std::is_trivially_copyable_v<T>, "Arena nodes are copied as bytes");
+
+            size_t first = arenas.empty() ? 0 : arenas.back().first + arenas.back().count;
+            arenas.push_back({ (char*)nodes, count, sizeof(T), first, &detail::arenaTag<T>, vector,
+                vector ? &resizeVector<T> : nullptr, &writeArena<T>, &swizzleArena<T> });
+            sortByAddress();
+            return *this;
+        }
+
+        void sortByAddress()
+        {
+            byAddress.resize(arenas.size());
+            for (size_t i = 0; i < arenas.size(); ++i)
+                byAddress[i] = i;
+
+            std::sort(byAddress.begin(), byAddress.end(), [&](size_t a, size_t b)
+            {
+                return (uintptr_t)arenas[a].nodes < (uintptr_t)arenas[b].nodes;
+            });
+        }
+
+        friend SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const PointerGraph& graph);
+        friend SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, PointerGraph& graph);
+
+    public:
+        // Grown or shrunk to the stored node count on read
+        template<typename T>
+        PointerGraph& add(std::vector<T>& nodes)
+        {
+            return add(nodes.data(), nodes.size(), &nodes);
+        }
+
+        // A fixed range; the stored node count must match it on read
+        template<typename T>
+        PointerGraph& add(T* nodes, size_t count)
+        {
+            return add(nodes, count, (std::vector<T>*)nullptr);
+        }
+    };
+
+    inline SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const PointerGraph& graph)
+    {
+        writer << graph.arenas.size();
+
+        for (auto&& arena : graph.arenas)
+        {
+            writer << arena.count;
+            arena.write(graph, writer, arena);
+        }
+
+        return writer;
+    }
+
+    inline SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, PointerGraph& graph)
+    {
+        size_t arenaCount = 0;
+        reader >> arenaCount;
+
+        if (arenaCount != graph.arenas.size())
+            reader.stream.setstate(std::ios::failbit);
+
+        size_t first = 0;
+        for (auto&& arena : graph.arenas)
+        {
+            size_t count = 0;
+            reader >> count;
+
+            if (!reader.stream)
+                return reader;
+
+            if (arena.resize)
+                arena.resize(arena, count);
+            else if (count != arena.count)
+                reader.stream.setstate(std::ios::failbit);
+
+            arena.first = first;
+            first += arena.count;
+            reader.stream.read(arena.nodes, arena.count * arena.nodeSize);
+        }
+
+        if (!reader.stream)
+            return reader;
+
+        graph.sortByAddress();
+
+        bool ok = true;
+        for (auto&& arena : graph.arenas)
+            ok &= arena.swizzle(graph, arena);
+
+        if (!ok)
+            reader.stream.setstate(std::ios::failbit);
+
+        return reader;
+    }
+
+    //////////////////////////////////////////////////////////////////////////////////
+    // Compression
+    //////////////////////////////////////////////////////////////////////////////////
+    namespace detail
+    {
+        // LEB128: 7 bits per byte, low bits first
+        inline char* putVarint(char* target, uint64_t value)
+        {
+            while (value >= 0x80)
+            {
+                *target++ = char(uint8_t(value) | 0x80);
+                value >>= 7;
+            }
+
+            *target++ = char(value);
+            return target;
+        }
+
+        // Null when the varint runs past end or past 64 bits
+        inline const char* getVarint(const char* source, const char* end, uint64_t& value)
+        {
+            value = 0;
+            for (int shift = 0; source < end && shift < 64; shift += 7)
+            {
+                uint8_t byte = uint8_t(*source++);
+                value |= uint64_t(byte & 0x7F) << shift;
+
+                if (byte < 0x80)
+                    return source;
+            }
+
+            return nullptr;
+        }
+
+        inline void writeVarint(SerBin<std::ios::out>& writer, uint64_t value)
+        {
+            char bytes[10];
+            writer.stream.write(bytes, putVarint(bytes, value) - bytes);
+        }
+
+        inline uint64_t readVarint(SerBin<std::ios::in>& reader)
+        {
+            uint64_t value = 0;
+            for (int shift = 0; shift < 64; shift += 7)
+            {
+                auto byte = reader.stream.get();
+                if (byte == std::char_traits<char>::eof())
+                    break;
+
+                value |= uint64_t(byte & 0x7F) << shift;
+                if (byte < 0x80)
+                    return value;
+            }
+
+            reader.stream.setstate(std::ios::failbit);
+            return 0;
+        }
+    }
+
+    // Sample-derived bytes that prime a codec for small messages: content that
+    // recurs across messages is then matched in the dictionary instead of being
+    // spelled out in every one. Id 0 means no dictionary.
+    struct Dictionary
+    {
+        uint32_t id = 0;
+        std::string bytes;
+    };
+
+    inline SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const Dictionary& dictionary)
+    {
+        return writer << dictionary.id << dictionary.bytes;
+    }
+
+    inline SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, Dictionary& dictionary)
+    {
+        return reader >> dictionary.id >> dictionary.bytes;
+    }
+
+    // Picks the segments of sample encodings whose short substrings recur in
+    // the most samples, best last, until capacity is filled (after COVER, as
+    // used by zstd --train). Offline; samples should look like the traffic.
+    inline Dictionary trainDictionary(uint32_t id, const std::vector<std::string>& samples, size_t capacity = 16 << 10)
+    {
+        constexpr size_t dmer = 6, segment = 48;
+        constexpr uint32_t none = ~uint32_t(0);
+
+        std::string all;
+        for (auto&& sample : samples)
+            all += sample;
+
+        Dictionary dictionary{ id, {} };
+        if (all.size() <= capacity)
+        {
+            dictionary.bytes = std::move(all);
+            return dictionary;
+        }
+
+        // Dense ids for every d-mer that lies within one sample, and how many samples contain each
+        std::vector<uint32_t> ids(all.size(), none);
+        std::vector<uint32_t> frequency, lastSample;
+        std::unordered_map<uint64_t, uint32_t> idOf;
+        size_t start = 0;
+        for (uint32_t s = 0; s < samples.size(); start += samples[s++].size())
+        {
+            for (size_t i = 0; i + dmer <= samples[s].size(); ++i)
+            {
+                uint64_t key = 0;
+                std::memcpy(&key, all.data() + start + i, dmer);
+                auto [entry, added] = idOf.try_emplace(key, uint32_t(frequency.size()));
+                if (added)
+                {
+                    frequency.push_back(0);
+                    lastSample.push_back(none);
+                }
+
+                uint32_t dmerId = entry->second;
+                ids[start + i] = dmerId;
+                if (lastSample[dmerId] != s)
+                {
+                    lastSample[dmerId] = s;
+                    ++frequency[dmerId];
+                }
+            }
+        }
+
+        // One best segment per epoch, scored by the sample counts of its
+        // distinct d-mers; a chosen d-mer scores nothing afterwards
+        std::vector<std::pair<uint64_t, size_t>> chosen;
+        std::vector<uint32_t> active(frequency.size(), 0);
+        size_t epochs = std::max<size_t>(1, capacity / segment);
+        size_t epochSize = std::max(segment, all.size() / epochs);
+
+        auto slide = [&](size_t position, int step, uint64_t& score)
+        {
+            uint32_t dmerId = ids[position];
+            if (dmerId == none)
+                return;
+
+            if (step > 0 && active[dmerId]++ == 0)
+                score += frequency[dmerId] > 1 ? frequency[dmerId] : 0;
+            else if (step < 0 && --active[dmerId] == 0)
+                score -= frequency[dmerId] > 1 ? frequency[dmerId] : 0;
+        };
+
+        for (size_t epoch = 0; epoch + segment <= all.size(); epoch += epochSize)
+        {
+            size_t end = std::min(all.size(), epoch + epochSize);
+            if (end - epoch < segment)
+                break;
+
+            uint64_t score = 0, bestScore = 0;
+            size_t best = epoch;
+            for (size_t i = epoch; i + dmer <= epoch + segment; ++i)
+                slide(i, 1, score);
+
+            bestScore = score;
+            for (size_t s = epoch + 1; s + segment <= end; ++s)
+            {
+                slide(s - 1, -1, score);
+                slide(s + segment - dmer, 1, score);
+
+                if (score > bestScore)
+                {
+                    bestScore = score;
+                    best = s;
+                }
+            }
+
+            for (size_t i = end - segment; i + dmer <= end; ++i)
+                slide(i, -1, score);
+
+            if (bestScore == 0)
+                continue;
+
+            chosen.push_back({ bestScore, best });
+            for (size_t i = best; i + dmer <= best + segment; ++i)
+                if (ids[i] != none)
+                    frequency[ids[i]] = 0;
+        }
+
+        std::sort(chosen.begin(), chosen.end());
+        for (auto&& [score, position] : chosen)
+            dictionary.bytes.append(all, position, segment);
+
+        if (dictionary.bytes.size() > capacity)
+            dictionary.bytes.erase(0, dictionary.bytes.size() - capacity);
+
+        return dictionary;
+    }
+
+    // Compresses one message at a time, optionally primed with a dictionary.
+    // Implement it to plug in zstd, lz4 and the like; const methods must be
+    // safe to call from many threads at once.
+    class Codec
+    {
+    public:
+        virtual ~Codec() = default;
+
+        // Written in every frame: 0 means stored, 1 is LZCodec
+        virtual uint8_t id() const = 0;
+
+        virtual uint32_t dictionaryId() const
+        {
+            return 0;
+        }
+
+        // Appends the compressed bytes to target
+        virtual void compress(const char* source, size_t size, MemoryBuffer& target) const = 0;
+
+        // Fills exactly targetSize bytes; false on corrupt input
+        virtual bool decompress(const char* source, size_t size, char* target, size_t targetSize) const = 0;
+    };
+
+    // Byte-oriented LZ77 whose window starts with the dictionary, so the first
+    // bytes of a message can already match. Sequences are [token: literal
+    // count | match length - 4][literal count extension][literals][varint
+    // offset][match length extension], the last one without a match; counts
+    // of 15 or more continue in bytes of 255 as in LZ4.
+    class LZCodec : public Codec
+    {
+        static constexpr size_t minMatch = 4;
+        static constexpr int dictionaryBits = 14, bucketSize = 4, messageBits = 13;
+
+        Dictionary dictionary;
+        std::vector<uint32_t> dictionaryTable; // bucketSize most recent positions + 1 per hash
+
+        static uint32_t hash(const char* at, int bits)
+        {
+            uint32_t word;
+            std::memcpy(&word, at, sizeof(word));
+            return (word * 2654435761u) >> (32 - bits);
+        }
+
+        static size_t matchLength(const char* a, const char* b, size_t limit)
+        {
+            size_t length = 0;
+            while (length < limit && a[length] == b[length])
+                ++length;
+
+            return length;
+        }
+
+        static char* putCount(char* target, size_t count)
+        {
+            for (count -= 15; count >= 255; count -= 255)
+                *target++ = char(255);
+
+            *target++ = char(count);
+            return target;
+        }
+
+        static const char* getCount(const char* source, const char* end, size_t& count)
+        {
+            for (uint8_t byte = 255; byte == 255;)
+            {
+                if (source == end)
+                    return nullptr;
+
+                byte = uint8_t(*source++);
+                count += byte;
+            }
+
+            return source;
+        }
+
+        static void putSequence(MemoryBuffer& target, const char* literals, size_t literalCount, size_t offset, size_t length)
+        {
+            char* start = target.prepare(literalCount + literalCount / 255 + 2 * 10 + length / 255 + 1);
+            char* at = start;
+            size_t extra = length ? length - minMatch : 0;
+            *at++ = char((std::min<size_t>(literalCount, 15) << 4) | std::min<size_t>(extra, 15));
+
+            if (literalCount >= 15)
+                at = putCount(at, literalCount);
+
+            std::memcpy(at, literals, literalCount);
+            at += literalCount;
+
+            if (length)
+            {
+                at = detail::putVarint(at, offset);
+                if (extra >= 15)
+                    at = putCount(at, extra);
+            }
+
+            target.commit(size_t(at - start));
+        }
+
+    public:
+        explicit LZCodec(Dictionary dictionary = {})
+            : dictionary(std::move(dictionary))
+        {
+            const std::string& bytes = this->dictionary.bytes;
+            if (bytes.size() < minMatch)
+                return;
+
+            dictionaryTable.assign(size_t(bucketSize) << dictionaryBits, 0);
+            for (size_t i = 0; i + minMatch <= bytes.size(); ++i)
+            {
+                uint32_t* bucket = &dictionaryTable[size_t(hash(bytes.data() + i, dictionaryBits)) * bucketSize];
+                std::memmove(bucket + 1, bucket, (bucketSize - 1) * sizeof(uint32_t));
+                bucket[0] = uint32_t(i + 1);
+            }
+        }
+
+        uint8_t id() const override
+        {
+            return 1;
+        }
+
+        uint32_t dictionaryId() const override
+        {
+            return dictionary.id;
+        }
+
+        void compress(const char* source, size_t size, MemoryBuffer& target) const override
+        {
+            const char* dictionaryBytes = dictionary.bytes.data();
+            size_t dictionarySize = dictionary.bytes.size();
+
+            uint32_t messageTable[size_t(1) << messageBits];
+            int bits = std::clamp(int(std::bit_width(size)), 8, messageBits);
+            std::memset(messageTable, 0, sizeof(uint32_t) << bits);
+
+            size_t anchor = 0, position = 0;
+            while (position + minMatch <= size)
+            {
+                const char* at = source + position;
+                size_t bestLength = 0, bestOffset = 0;
+
+                uint32_t& slot = messageTable[hash(at, bits)];
+                if (slot != 0)
+                {
+                    size_t length = matchLength(source + slot - 1, at, size - position);
+                    bestLength = length;
+                    bestOffset = position - (slot - 1);
+                }
+
+                slot = uint32_t(position + 1);
+
+                if (!dictionaryTable.empty())
+                {
+                    const uint32_t* bucket = &dictionaryTable[size_t(hash(at, dictionaryBits)) * bucketSize];
+                    for (int i = 0; i < bucketSize && bucket[i] != 0; ++i)
+                    {
+                        size_t candidate = bucket[i] - 1;
+                        size_t length = matchLength(dictionaryBytes + candidate, at, std::min(dictionarySize - candidate, size - position));
+                        if (length > bestLength)
+                        {
+                            bestLength = length;
+                            bestOffset = dictionarySize - candidate + position;
+                        }
+                    }
+                }
+
+                if (bestLength < minMatch)
+                {
+                    ++position;
+                    continue;
+                }
+
+                putSequence(target, source + anchor, position - anchor, bestOffset, bestLength);
+
+                for (size_t end = position + bestLength; ++position < end;)
+                    if (position + minMatch <= size)
+                        messageTable[hash(source + position, bits)] = uint32_t(position + 1);
+
+                anchor = position;
+            }
+
+            putSequence(target, source + anchor, size - anchor, 0, 0);
+        }
+
+        bool decompress(const char* source, size_t size, char* target, size_t targetSize) const override
+        {
+            const char* end = source + size;
+            const char* dictionaryBytes = dictionary.bytes.data();
+            size_t dictionarySize = dictionary.bytes.size();
+            size_t written = 0;
+
+            while (source < end)
+            {
+                uint8_t token = uint8_t(*source++);
+                size_t literalCount = token >> 4, length = (token & 15);
+
+                if (literalCount == 15 && !(source = getCount(source, end, literalCount)))
+                    return false;
+
+                if (literalCount > size_t(end - source) || literalCount > targetSize - written)
+                    return false;
+
+                std::memcpy(target + written, source, literalCount);
+                source += literalCount;
+                written += literalCount;
+
+                if (written == targetSize)
+                    return source == end;
+
+                uint64_t offset;
+                if (!(source = detail::getVarint(source, end, offset)))
+                    return false;
+
+                if (length == 15 && !(source = getCount(source, end, length)))
+                    return false;
+
+                length += minMatch;
+                if (offset == 0 || offset > dictionarySize + written || length > targetSize - written)
+                    return false;
+
+                // The window is the dictionary followed by the output so far
+                size_t from = dictionarySize + written - size_t(offset);
+                for (; length > 0 && from < dictionarySize; --length)
+                    target[written++] = dictionaryBytes[from++];
+
+                for (from -= std::min(from, dictionarySize); length > 0; --length)
+                    target[written++] = target[from++];
+            }
+
+            return false;
+        }
+    };
+
+    class Compression;
+
+    template<typename T>
+    struct Compressed
+    {
+        T& object;
+        Compression& compression;
+    };
+
+    // Per-thread state for compressed messages: the codec writes use, every
+    // codec reads may meet (matched on codec and dictionary id), and scratch
+    // buffers that are reused from one message to the next.
+    class Compression
+    {
+        std::vector<std::shared_ptr<const Codec>> codecs;
+        const Codec* writing = nullptr;
+        MemoryBuffer plain, packed;
+        SerBin<std::ios::out> encoder{ plain };
+        size_t maxSize = size_t(256) << 20;
+
+        template<typename T>
+        friend SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const Compressed<T>& message);
+
+        template<typename T>
+        friend SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, Compressed<T> message);
+
+    public:
+        Compression() = default;
+
+        explicit Compression(std::shared_ptr<const Codec> codec)
+        {
+            use(std::move(codec));
+        }
+
+        // Accepted when reading
+        Compression& add(std::shared_ptr<const Codec> codec)
+        {
+            codecs.push_back(std::move(codec));
+            return *this;
+        }
+
+        // Written with from now on, and accepted when reading
+        Compression& use(std::shared_ptr<const Codec> codec)
+        {
+            writing = codec.get();
+            return add(std::move(codec));
+        }
+
+        // Reads of messages claiming to be bigger fail before anything is
+        // allocated for them; 256 MB by default
+        Compression& limit(size_t maxMessageSize)
+        {
+            maxSize = maxMessageSize;
+            return *this;
+        }
+    };
+
+    // Each message is framed as [uint8 codec id][varint dictionary id][varint
+    // size][varint compressed size][compressed bytes], and stored as is under
+    // codec id 0 when compressing doesn't make it smaller.
+    template<typename T>
+    inline Compressed<T> compressed(T& object, Compression& compression)
+    {
+        return { object, compression };
+    }
+
+    template<typename T>
+    inline SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const Compressed<T>& message)
+    {
+        Compression& compression = message.compression;
+        compression.plain.clear();
+        compression.encoder << std::as_const(message.object);
+
+        const char* bytes = compression.plain.data();
+        size_t size = compression.plain.size();
+        const Codec* codec = compression.writing;
+
+        if (codec)
+        {
+            compression.packed.clear();
+            codec->compress(bytes, size, compression.packed);
+
+            if (compression.packed.size() < size)
+            {
+                writer << codec->id();
+                detail::writeVarint(writer, codec->dictionaryId());
+                detail::writeVarint(writer, size);
+                detail::writeVarint(writer, compression.packed.size());
+                writer.stream.write(compression.packed.data(), std::streamsize(compression.packed.size()));
+                return writer;
+            }
+        }
+
+        writer << uint8_t(0);
+        detail::writeVarint(writer, 0);
+        detail::writeVarint(writer, size);
+        detail::writeVarint(writer, size);
+        writer.stream.write(bytes, std::streamsize(size));
+        return writer;
+    }
+
+    template<typename T>
+    inline SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, Compressed<T> message)
+    {
+        static_assert(!std::is_const_v<T>, "Reading needs a mutable object");
+
+        Compression& compression = message.compression;
+        uint8_t codecId = 0;
+        reader >> codecId;
+        uint64_t dictionaryId = detail::readVarint(reader);
+        uint64_t size = detail::readVarint(reader);
+        uint64_t packedSize = detail::readVarint(reader);
+
+        // Codec frames are only written when smaller, stored ones are exact
+        if (size > compression.maxSize || packedSize > size || (codecId == 0 && packedSize != size))
+            reader.stream.setstate(std::ios::failbit);
+
+        if (!reader.stream)
+            return reader;
+
+        compression.plain.clear();
+        compression.packed.clear();
+        char* plain = compression.plain.prepare(size_t(size));
+
+        if (codecId == 0)
+        {
+            reader.stream.read(plain, std::streamsize(size));
+        }
+        else
+        {
+            auto codec = std::find_if(compression.codecs.begin(), compression.codecs.end(), [&](auto&& candidate)
+            {
+                return candidate->id() == codecId && candidate->dictionaryId() == dictionaryId;
+            });
+
+            char* packed = compression.packed.prepare(size_t(packedSize));
+            reader.stream.read(packed, std::streamsize(packedSize));
+
+            if (codec == compression.codecs.end() || (reader.stream && !(*codec)->decompress(packed, size_t(packedSize), plain, size_t(size))))
+                reader.stream.setstate(std::ios::failbit);
+        }
+
+        if (!reader.stream)
+            return reader;
+
+        compression.plain.commit(size_t(size));
+        FixedReader decoder(compression.plain.data(), compression.plain.size());
+        decoder >> message.object;
+
+        if (!decoder.stream)
+            reader.stream.setstate(std::ios::failbit);
+
+        return reader;
+    }
+
+    //////////////////////////////////////////////////////////////////////////////////
+    // Schema fingerprints
+    //////////////////////////////////////////////////////////////////////////////////
+    // What your own types stream, in order, so they have a fingerprint, e.g.
+    //   template<> constexpr auto serbin::schemaFields<Order> = serbin::Fields<uint64_t, std::string, std::vector<Line>>();
+    template<typename... Ts>
+    struct Fields
+    {
+    };
+
+    template<typename T>
+    constexpr auto schemaFields = nullptr;
+
+    namespace detail
+    {
+        enum class Shape : uint64_t
+        {
+            Bool = 1,
+            Signed,
+            Unsigned,
+            Float,
+            POD,
+            String,
+            Sequence,
+            Array,
+            Tuple,
+            Optional,
+            Compressed,
+        };
+
+        constexpr uint64_t combine(uint64_t hash, uint64_t value)
+        {
+            hash = (hash ^ value) * 0x9E3779B97F4A7C15ull;
+            return hash ^ (hash >> 32);
+        }
+
+        constexpr uint64_t combine(uint64_t hash, Shape shape)
+        {
+            return combine(hash, uint64_t(shape));
+        }
+
+        template<typename... Ts>
+        constexpr uint64_t tupleOf();
+
+        template<typename... Ts>
+        constexpr uint64_t tupleOf(Fields<Ts...>)
+        {
+            return tupleOf<Ts...>();
+        }
+
+        // The serialized shape only: whatever writes the same bytes (std::vector
+        // and std::set, a struct and a tuple of its fields) shares a fingerprint
+        template<typename T>
+        struct Fingerprint
+        {
+            static constexpr uint64_t compute()
+            {
+                if constexpr (std::is_same_v<T, bool>)
+                    return combine(0, Shape::Bool);
+                else if constexpr (std::is_integral_v<T>)
+                    return combine(combine(0, std::is_signed_v<T> ? Shape::Signed : Shape::Unsigned), sizeof(T));
+                else if constexpr (std::is_floating_point_v<T>)
+                    return combine(combine(0, Shape::Float), sizeof(T));
+                else if constexpr (serializeAsPOD<T>)
+                    return combine(combine(0, Shape::POD), sizeof(T));
+                else
+                {
+                    static_assert(!std::is_null_pointer_v<std::remove_cv_t<decltype(schemaFields<T>)>>, "Describe T with schemaFields<T>");
+                    return tupleOf(schemaFields<T>);
+                }
+            }
+
+            static constexpr uint64_t value = compute();
+        };
+
+        template<typename T>
+        constexpr uint64_t sequenceOf(Encoding encoding = Encoding::Raw)
+        {
+            return combine(combine(combine(0, Shape::Sequence), uint64_t(encoding)), Fingerprint<T>::value);
+        }
+
+        // Raw arrays keep the fingerprint they had before encodeAs applied to them
+        template<typename T, size_t N>
+        constexpr uint64_t arrayOf()
+        {
+            uint64_t hash = combine(combine(0, Shape::Array), N);
+            if constexpr (serializeAsPOD<T>)
+            {
+                if (encodeAs<T> != Encoding::Raw)
+                    hash = combine(hash, uint64_t(encodeAs<T>));
+            }
+
+            return combine(hash, Fingerprint<T>::value);
+        }
+
+        template<typename... Ts>
+        constexpr uint64_t tupleOf()
+        {
+            uint64_t hash = combine(combine(0, Shape::Tuple), sizeof...(Ts));
+            ((hash = combine(hash, Fingerprint<Ts>::value)), ...);
+            return hash;
+        }
+
+        template<typename T>
+        struct Fingerprint<const T> : Fingerprint<T> {};
+
+        template<typename T>
+        struct Fingerprint<std::basic_string<T>> { static constexpr uint64_t value = combine(combine(0, Shape::String), sizeof(T)); };
+
+        template<typename T>
+        struct Fingerprint<std::vector<T>> { static constexpr uint64_t value = sequenceOf<T>(serializeAsPOD<T> ? encodeAs<T> : Encoding::Raw); };
+
+        template<Encoding E, typename T>
+        struct Fingerprint<Encoded<E, std::vector<T>>> { static constexpr uint64_t value = sequenceOf<T>(E); };
+
+        template<typename T>
+        struct Fingerprint<std::list<T>> { static constexpr uint64_t value = sequenceOf<T>(); };
+
+        template<typename T>
+        struct Fingerprint<std::deque<T>> { static constexpr uint64_t value = sequenceOf<T>(); };
+
+        template<typename T>
+        struct Fingerprint<std::set<T>> { static constexpr uint64_t value = sequenceOf<T>(); };
+
+        template<typename T>
+        struct Fingerprint<std::unordered_set<T>> { static constexpr uint64_t value = sequenceOf<T>(); };
+
+        template<typename K, typename V>
+        struct Fingerprint<std::map<K, V>> { static constexpr uint64_t value = sequenceOf<std::pair<K, V>>(); };
+
+        template<typename K, typename V>
+        struct Fingerprint<std::unordered_map<K, V>> { static constexpr uint64_t value = sequenceOf<std::pair<K, V>>(); };
+
+        template<typename T, size_t N>
+        struct Fingerprint<std::array<T, N>> { static constexpr uint64_t value = arrayOf<T, N>(); };
+
+        template<typename A, typename B>
+        struct Fingerprint<std::pair<A, B>> { static constexpr uint64_t value = tupleOf<A, B>(); };
+
+        template<typename... Ts>
+        struct Fingerprint<std::tuple<Ts...>> { static constexpr uint64_t value = tupleOf<Ts...>(); };
+
+        template<typename T>
+        struct Fingerprint<std::optional<T>> { static constexpr uint64_t value = combine(combine(0, Shape::Optional), Fingerprint<T>::value); };
+
+        template<typename T>
+        struct Fingerprint<std::unique_ptr<T>> : Fingerprint<std::optional<T>> {};
+
+        template<typename T>
+        struct Fingerprint<std::shared_ptr<T>> : Fingerprint<std::optional<T>> {};
+
+        template<typename T>
+        struct Fingerprint<Compressed<T>> { static constexpr uint64_t value = combine(combine(0, Shape::Compressed), Fingerprint<T>::value); };
+    }
+
+    // Structural fingerprint of how T is serialized, nested containers and
+    // encodings included, for catching a reader/writer type mismatch up front
+    template<typename T>
+    constexpr uint64_t schemaFingerprint = detail::Fingerprint<T>::value;
+
+    template<typename T>
+    struct WithSchema
+    {
+        T& object;
+    };
+
+    // Prefixes the object with schemaFingerprint<T>. A reader expecting a
+    // different shape fails with failbit before decoding a single field.
+    template<typename T>
+    inline WithSchema<T> withSchema(T& object)
+    {
+        return { object };
+    }
+
+    template<typename T>
+    inline SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const WithSchema<T>& object)
+    {
+        return writer << schemaFingerprint<std::remove_const_t<T>> << std::as_const(object.object);
+    }
+
+    template<typename T>
+    inline SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, WithSchema<T> object)
+    {
+        static_assert(!std::is_const_v<T>, "Reading needs a mutable object");
+
+        uint64_t fingerprint = 0;
+        reader >> fingerprint;
+
+        if (fingerprint != schemaFingerprint<T>)
+            reader.stream.setstate(std::ios::failbit);
+        else
+            reader >> object.object;
+
+        return reader;
+    }
+
+    //////////////////////////////////////////////////////////////////////////////////
+    // Ordered keys
+    //////////////////////////////////////////////////////////////////////////////////
+    // A separate encoding for keys in sorted tables: comparing two encoded keys
+    // with memcmp (or std::string <) gives the same order as operator< on the
+    // keys, so merges and lookups never decode. Integers are big-endian with
+    // the sign bit flipped, floats get the sign-dependent bit flip (-0 sorts
+    // before +0), strings escape 0 as 00 FF and end in 00 01, optionals and
+    // vectors put a 00/01 marker before each value, and tuples, pairs and
+    // arrays concatenate their members. Keys are self-delimiting.
+    namespace detail
+    {
+        struct KeyBytesOut
+        {
+            std::string& bytes;
+
+            void put(const char* source, size_t count)
+            {
+                bytes.append(source, count);
+            }
+        };
+
+        struct KeyStreamOut
+        {
+            std::iostream& stream;
+
+            void put(const char* source, size_t count)
+            {
+                stream.write(source, std::streamsize(count));
+            }
+        };
+
+        struct KeyBytesIn
+        {
+            const char* at;
+            const char* end;
+
+            bool get(char* target, size_t count)
+            {
+                if (size_t(end - at) < count)
+                    return false;
+
+                std::memcpy(target, at, count);
+                at += count;
+                return true;
+            }
+        };
+
+        struct KeyStreamIn
+        {
+            std::iostream& stream;
+
+            bool get(char* target, size_t count)
+            {
+                return bool(stream.read(target, std::streamsize(count)));
+            }
+        };
+
+        template<typename U>
+        inline void putBigEndian(char* target, U value)
+        {
+            for (size_t i = sizeof(U); i-- > 0; value >>= 8)
+                target[i] = char(uint8_t(value));
+        }
+
+        template<typename U>
+        inline U getBigEndian(const char* source)
+        {
+            U value = 0;
+            for (size_t i = 0; i < sizeof(U); ++i)
+                value = U(value << 8) | U(uint8_t(source[i]));
+
+            return value;
+        }
+
+        // The unsigned integer whose order matches T's
+        template<typename T>
+        inline auto orderedBits(T value)
+        {
+            if constexpr (std::is_floating_point_v<T>)
+            {
+                using U = std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>;
+                U bits = std::bit_cast<U>(value);
+                constexpr U sign = U(1) << (sizeof(U) * 8 - 1);
+                return (bits & sign) ? U(~bits) : U(bits | sign);
+            }
+            else
+            {
+                using U = std::make_unsigned_t<T>;
+                return std::is_signed_v<T> ? U(U(value) ^ (U(1) << (sizeof(U) * 8 - 1))) : U(value);
+            }
+        }
+
+        template<typename T, typename U>
+        inline T fromOrderedBits(U bits)
+        {
+            if constexpr (std::is_floating_point_v<T>)
+            {
+                constexpr U sign = U(1) << (sizeof(U) * 8 - 1);
+                return std::bit_cast<T>((bits & sign) ? U(bits ^ sign) : U(~bits));
+            }
+            else
+            {
+                return T(std::is_signed_v<T> ? U(bits ^ (U(1) << (sizeof(U) * 8 - 1))) : bits);
+            }
+        }
+
+        template<typename T>
+        constexpr bool isKeyArithmetic = std::is_arithmetic_v<T> && !std::is_same_v<T, bool>
+            && (!std::is_floating_point_v<T> || sizeof(T) == 4 || sizeof(T) == 8);
+
+        template<typename Out, typename T>
+        inline void writeKey(Out& out, const T& key);
+
+        template<typename In, typename T>
+        inline bool readKey(In& in, T& key);
+
+        template<typename Out, typename C>
+        inline void writeKeyString(Out& out, const std::basic_string<C>& key)
+        {
+            constexpr char escaped[2] = { 0, char(0xFF) }, terminator[2] = { 0, 1 };
+            char unit[sizeof(C)];
+
+            for (C c : key)
+            {
+                putBigEndian(unit, std::make_unsigned_t<C>(c));
+                for (char byte : unit)
+                {
+                    if (byte == 0)
+                        out.put(escaped, 2);
+                    else
+                        out.put(&byte, 1);
+                }
+            }
+
+            out.put(terminator, 2);
+        }
+
+        template<typename In, typename C>
+        inline bool readKeyString(In& in, std::basic_string<C>& key)
+        {
+            key.clear();
+            char unit[sizeof(C)];
+            size_t filled = 0;
+
+            for (;;)
+            {
+                char byte;
+                if (!in.get(&byte, 1))
+                    return false;
+
+                if (byte == 0)
+                {
+                    char marker;
+                    if (!in.get(&marker, 1))
+                        return false;
+                    if (marker == 1)
+                        return filled == 0;
+                    if (marker != char(0xFF))
+                        return false;
+                }
+
+                unit[filled++] = byte;
+                if (filled == sizeof(C))
+                {
+                    key.push_back(C(getBigEndian<std::make_unsigned_t<C>>(unit)));
+                    filled = 0;
+                }
+            }
+        }
+
+        template<typename Out, typename T>
+        inline void writeKey(Out& out, const T& key)
+        {
+            if constexpr (std::is_same_v<T, bool>)
+            {
+                char byte = key ? 1 : 0;
+                out.put(&byte, 1);
+            }
+            else if constexpr (isKeyArithmetic<T>)
+            {
+                auto bits = orderedBits(key);
+                char bytes[sizeof(bits)];
+                putBigEndian(bytes, bits);
+                out.put(bytes, sizeof(bytes));
+            }
+            else if constexpr (requires { typename T::traits_type; typename T::value_type; key.c_str(); })
+            {
+                writeKeyString(out, key);
+            }
+            else if constexpr (requires { key.has_value(); *key; })
+            {
+                char marker = key ? 1 : 0;
+                out.put(&marker, 1);
+                if (key)
+                    writeKey(out, *key);
+            }
+            else if constexpr (requires { std::tuple_size<T>::value; })
+            {
+                std::apply([&](auto&&... members) { (writeKey(out, members), ...); }, key);
+            }
+            else if constexpr (requires { key.begin(); key.end(); })
+            {
+                constexpr char more = 1, done = 0;
+                for (auto&& element : key)
+                {
+                    out.put(&more, 1);
+                    writeKey(out, element);
+                }
+
+                out.put(&done, 1);
+            }
+            else
+            {
+                static_assert(std::is_same_v<T, void>, "No ordered key encoding for T");
+            }
+        }
+
+        template<typename In, typename T>
+        inline bool readKey(In& in, T& key)
+        {
+            if constexpr (std::is_same_v<T, bool>)
+            {
+                char byte = 0;
+                bool ok = in.get(&byte, 1) && (byte == 0 || byte == 1);
+                key = byte == 1;
+                return ok;
+            }
+            else if constexpr (isKeyArithmetic<T>)
+            {
+                using U = decltype(orderedBits(key));
+                char bytes[sizeof(U)];
+                if (!in.get(bytes, sizeof(bytes)))
+                    return false;
+
+                key = fromOrderedBits<T>(getBigEndian<U>(bytes));
+                return true;
+            }
+            else if constexpr (requires { typename T::traits_type; typename T::value_type; key.c_str(); })
+            {
+                return readKeyString(in, key);
+            }
+            else if constexpr (requires { key.has_value(); *key; })
+            {
+                char marker;
+                if (!in.get(&marker, 1) || (marker != 0 && marker != 1))
+                    return false;
+
+                if (marker == 0)
+                {
+                    key.reset();
+                    return true;
+                }
+
+                key.emplace();
+                return readKey(in, *key);
+            }
+            else if constexpr (requires { std::tuple_size<T>::value; })
+            {
+                return std::apply([&](auto&... members) { return (readKey(in, members) && ...); }, key);
+            }
+            else if constexpr (requires { key.begin(); key.end(); })
+            {
+                key.clear();
+                for (;;)
+                {
+                    char marker;
+                    if (!in.get(&marker, 1) || (marker != 0 && marker != 1))
+                        return false;
+                    if (marker == 0)
+                        return true;
+
+                    typename T::value_type element;
+                    if (!readKey(in, element))
+                        return false;
+
+                    key.insert(key.end(), std::move(element));
+                }
+            }
+            else
+            {
+                static_assert(std::is_same_v<T, void>, "No ordered key encoding for T");
+            }
+        }
+    }
+
+    // Appends the ordered encoding of key, e.g. to a reused buffer in a merge loop
+    template<typename T>
+    inline void appendKey(std::string& bytes, const T& key)
+    {
+        detail::KeyBytesOut out{ bytes };
+        detail::writeKey(out, key);
+    }
+
+    template<typename T>
+    inline std::string encodeKey(const T& key)
+    {
+        std::string bytes;
+        appendKey(bytes, key);
+        return bytes;
+    }
+
+    // Decodes one key from the front of [data, data + size); the number of
+    // bytes it took, or 0 if they don't hold a valid T
+    template<typename T>
+    inline size_t decodeKey(const char* data, size_t size, T& key)
+    {
+        detail::KeyBytesIn in{ data, data + size };
+        return detail::readKey(in, key) ? size_t(in.at - data) : 0;
+    }
+
+    template<typename T>
+    struct AsKey
+    {
+        T& key;
+    };
+
+    // Streams a key in its ordered encoding, on both the write and the read
+    template<typename T>
+    inline AsKey<T> asKey(T& key)
+    {
+        return { key };
+    }
+
+    template<typename T>
+    inline SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const AsKey<T>& key)
+    {
+        detail::KeyStreamOut out{ writer.stream };
+        detail::writeKey(out, std::as_const(key.key));
+        return writer;
+    }
+
+    template<typename T>
+    inline SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, AsKey<T> key)
+    {
+        static_assert(!std::is_const_v<T>, "Reading needs a mutable key");
+
+        detail::KeyStreamIn in{ reader.stream };
+        if (!detail::readKey(in, key.key))
+            reader.stream.setstate(std::ios::failbit);
+
+        return reader;
+    }
+
+    //////////////////////////////////////////////////////////////////////////////////
+    // Front-coded strings
+    //////////////////////////////////////////////////////////////////////////////////
+    // Sorted string keys that share long prefixes, e.g. paths or qualified
+    // names. Each key is [varint length shared with the previous key][varint
+    // suffix length][suffix], the first one sharing nothing. Decoding is
+    // sequential, as for every other container. For std::set and std::map
+    // with std::basic_string keys, on both the write and the read.
+    template<typename C>
+    struct FrontCoded
+    {
+        C& container;
+    };
+
+    template<typename C>
+    inline FrontCoded<C> frontCoded(C& container)
+    {
+        return { container };
+    }
+
+    namespace detail
+    {
+        // Suffixes are read in pieces of this many characters, so a corrupt
+        // length fails at the end of the stream rather than allocating first
+        constexpr size_t frontCodingPiece = 4096;
+
+        template<typename K>
+        inline const K& keyOf(const K& key)
+        {
+            return key;
+        }
+
+        template<typename K, typename V>
+        inline const K& keyOf(const std::pair<const K, V>& kv)
+        {
+            return kv.first;
+        }
+    }
+
+    template<typename C>
+    inline SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const FrontCoded<C>& object)
+    {
+        using Char = typename C::key_type::value_type;
+        const typename C::key_type* previous = nullptr;
+
+        writer << object.container.size();
+        for (auto&& element : object.container)
+        {
+            auto& key = detail::keyOf(element);
+            size_t shared = 0;
+            if (previous)
+                shared = size_t(std::mismatch(key.begin(), key.end(), previous->begin(), previous->end()).first - key.begin());
+
+            char header[20];
+            char* end = detail::putVarint(detail::putVarint(header, shared), key.size() - shared);
+            writer.stream.write(header, end - header);
+            writer.stream.write((const char*)(key.data() + shared), std::streamsize((key.size() - shared) * sizeof(Char)));
+
+            if constexpr (requires { typename C::mapped_type; })
+                writer << element.second;
+
+            previous = &key;
+        }
+
+        return writer;
+    }
+
+    // Keys arrive sorted, so each goes in with an end() hint
+    template<typename C>
+    inline SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, FrontCoded<C> object)
+    {
+        static_assert(!std::is_const_v<C>, "Reading needs a mutable container");
+        using Char = typename C::key_type::value_type;
+
+        decltype(object.container.size()) s;
+        reader >> s;
+
+        typename C::key_type key;
+        for (decltype(s) i = 0; i < s && reader.stream; ++i)
+        {
+            uint64_t shared = detail::readVarint(reader);
+            uint64_t suffix = detail::readVarint(reader);
+            if (!reader.stream || shared > key.size())
+            {
+                reader.stream.setstate(std::ios::failbit);
+                break;
+            }
+
+            key.resize(size_t(shared));
+            for (uint64_t left = suffix; left > 0 && reader.stream;)
+            {
+                size_t piece = size_t(std::min<uint64_t>(left, detail::frontCodingPiece));
+                key.resize(key.size() + piece);
+                reader.stream.read((char*)(key.data() + key.size() - piece), std::streamsize(piece * sizeof(Char)));
+                left -= piece;
+            }
+
+            if (!reader.stream)
+                break;
+
+            if constexpr (requires { typename C::mapped_type; })
+            {
+                typename C::mapped_type value;
+                reader >> value;
+                object.container.emplace_hint(object.container.end(), key, std::move(value));
+            }
+            else
+            {
+                object.container.emplace_hint(object.container.end(), key);
+            }
+        }
+
+        return reader;
+    }
+
+    //////////////////////////////////////////////////////////////////////////////////
+    // Tries
+    //////////////////////////////////////////////////////////////////////////////////
+    // A static string set, or string to unsigned integer map, as a radix trie
+    // that TrieView searches where it lies, e.g. in a mapped file. A node is
+    // [varint prefix length << 1 | terminal][prefix][varint value, maps only]
+    // [varint child count << 2 | distance width code][child first bytes]
+    // [distances back to the children], children before their parent. The
+    // image ends with [uint64 root offset][uint64 key count][uint8 has values].
+    namespace detail
+    {
+        constexpr size_t trieFooter = 17;
+
+        // A visitor may return void, or false to stop
+        template<typename Visit>
+        inline bool visitTrieKey(Visit& visit, std::string_view key, uint64_t value)
+        {
+            if constexpr (std::is_void_v<std::invoke_result_t<Visit&, std::string_view, uint64_t>>)
+            {
+                visit(key, value);
+                return true;
+            }
+            else
+            {
+                return bool(visit(key, value));
+            }
+        }
+
+        struct TrieBuilder
+        {
+            std::vector<std::pair<std::string_view, uint64_t>> keys;
+            bool values = false;
+            std::string image;
+
+            // Writes the subtree of keys[begin, end), which share their first
+            // depth bytes, and returns the offset of its root
+            size_t build(size_t begin, size_t end, size_t depth)
+            {
+                std::string_view first = keys[begin].first, last = keys[end - 1].first;
+                size_t common = depth + size_t(std::mismatch(first.begin() + depth, first.end(), last.begin() + depth, last.end()).first - (first.begin() + depth));
+                bool terminal = first.size() == common;
+
+                std::vector<std::pair<uint8_t, size_t>> children;
+                for (size_t i = begin + terminal, j; i < end; i = j)
+                {
+                    uint8_t label = uint8_t(keys[i].first[common]);
+                    for (j = i + 1; j < end && uint8_t(keys[j].first[common]) == label; ++j)
+                        ;
+
+                    children.emplace_back(label, build(i, j, common + 1));
+                }
+
+                size_t node = image.size();
+                size_t farthest = children.empty() ? 0 : node - children.front().second;
+                unsigned widthCode = farthest <= 0xFF ? 0 : farthest <= 0xFFFF ? 1 : farthest <= 0xFFFFFFFF ? 2 : 3;
+
+                char header[30];
+                char* at = putVarint(header, (common - depth) << 1 | terminal);
+                image.append(header, at);
+                image.append(first.data() + depth, common - depth);
+
+                at = header;
+                if (terminal && values)
+                    at = putVarint(at, keys[begin].second);
+                at = putVarint(at, children.size() << 2 | widthCode);
+                image.append(header, at);
+
+                for (auto&& child : children)
+                    image.push_back(char(child.first));
+                for (auto&& child : children)
+                {
+                    uint64_t distance = node - child.second;
+                    image.append((const char*)&distance, size_t(1) << widthCode);
+                }
+
+                return node;
+            }
+        };
+    }
+
+    // Builds the trie image of a std::set<std::string> or a std::map from
+    // std::string to an unsigned integer. Write it like any std::string.
+    template<typename C>
+    inline std::string encodeTrie(const C& container)
+    {
+        detail::TrieBuilder builder;
+        builder.keys.reserve(container.size());
+
+        for (auto&& element : container)
+        {
+            if constexpr (requires { typename C::mapped_type; })
+            {
+                static_assert(std::is_integral_v<typename C::mapped_type> && std::is_unsigned_v<typename C::mapped_type>, "Trie values are unsigned integers");
+                builder.keys.emplace_back(element.first, uint64_t(element.second));
+                builder.values = true;
+            }
+            else
+            {
+                builder.keys.emplace_back(element, 0);
+            }
+        }
+
+        uint64_t root = 0;
+        if (builder.keys.empty())
+            builder.image.append(2, '\0');
+        else
+            root = builder.build(0, builder.keys.size(), 0);
+
+        uint64_t count = builder.keys.size();
+        builder.image.append((const char*)&root, sizeof(root));
+        builder.image.append((const char*)&count, sizeof(count));
+        builder.image.push_back(char(builder.values));
+        return std::move(builder.image);
+    }
+
+    // Lookups on a trie image without loading it. Every read is bounds
+    // checked, so a damaged image gives wrong answers, never a crash. Not
+    // valid() if the image is too short or its root doesn't parse.
+    class TrieView
+    {
+        struct Node
+        {
+            size_t offset;
+            std::string_view prefix;
+            bool terminal;
+            uint64_t value;
+            size_t childCount;
+            size_t width;
+            const char* labels;
+        };
+
+        const char* data = nullptr;
+        const char* end = nullptr;
+        uint64_t root = 0;
+        uint64_t count = 0;
+        bool values = false;
+
+        bool parse(size_t offset, Node& node) const
+        {
+            uint64_t header, children;
+            const char* at = data + offset;
+            if (!(at = detail::getVarint(at, end, header)) || uint64_t(end - at) < (header >> 1))
+                return false;
+
+            node.offset = offset;
+            node.prefix = { at, size_t(header >> 1) };
+            node.terminal = header & 1;
+            node.value = 0;
+            at += node.prefix.size();
+
+            if (node.terminal && values && !(at = detail::getVarint(at, end, node.value)))
+                return false;
+            if (!(at = detail::getVarint(at, end, children)))
+                return false;
+
+            node.childCount = size_t(children >> 2);
+            node.width = size_t(1) << (children & 3);
+            node.labels = at;
+            return node.childCount <= 256 && uint64_t(end - at) >= node.childCount * (1 + node.width);
+        }
+
+        // SIZE_MAX if the distance doesn't lead backwards, so walks always end
+        size_t childAt(const Node& node, size_t i) const
+        {
+            uint64_t distance = 0;
+            std::memcpy(&distance, node.labels + node.childCount + i * node.width, node.width);
+            return distance > 0 && distance <= node.offset ? size_t(node.offset - distance) : SIZE_MAX;
+        }
+
+        size_t child(const Node& node, uint8_t label) const
+        {
+            const uint8_t* labels = (const uint8_t*)node.labels;
+            const uint8_t* found = std::lower_bound(labels, labels + node.childCount, label);
+            return found != labels + node.childCount && *found == label ? childAt(node, size_t(found - labels)) : SIZE_MAX;
+        }
+
+        std::optional<uint64_t> lookup(std::string_view key) const
+        {
+            Node node;
+            for (size_t offset = size_t(root); data && offset != SIZE_MAX && parse(offset, node);)
+            {
+                if (key.substr(0, node.prefix.size()) != node.prefix)
+                    return std::nullopt;
+
+                key.remove_prefix(node.prefix.size());
+                if (key.empty())
+                    return node.terminal ? std::optional<uint64_t>(node.value) : std::nullopt;
+
+                offset = child(node, uint8_t(key[0]));
+                key.remove_prefix(1);
+            }
+
+            return std::nullopt;
+        }
+
+    public:
+        TrieView() = default;
+
+        TrieView(const void* image, size_t size)
+        {
+            if (size < detail::trieFooter)
+                return;
+
+            const char* footer = (const char*)image + size - detail::trieFooter;
+            std::memcpy(&root, footer, sizeof(root));
+            std::memcpy(&count, footer + sizeof(root), sizeof(count));
+            values = footer[2 * sizeof(uint64_t)] != 0;
+
+            data = (const char*)image;
+            end = footer;
+
+            Node node;
+            if (root >= uint64_t(end - data) || !parse(size_t(root), node))
+                data = end = nullptr;
+        }
+
+        explicit TrieView(const std::string& image)
+            : TrieView(image.data(), image.size())
+        {
+        }
+
+        bool valid() const
+        {
+            return data != nullptr;
+        }
+
+        size_t size() const
+        {
+            return size_t(count);
+        }
+
+        bool contains(std::string_view key) const
+        {
+            return lookup(key).has_value();
+        }
+
+        // The key's value in a map image; 0 for keys of a set image
+        std::optional<uint64_t> find(std::string_view key) const
+        {
+            return lookup(key);
+        }
+
+        // Calls visit(std::string_view key, uint64_t value) for each key that
+        // starts with prefix, in sorted order, until it returns false
+        template<typename Visit>
+        void forEachWithPrefix(std::string_view prefix, Visit visit) const
+        {
+            Node node;
+            std::string path;
+            size_t offset = size_t(root);
+
+            for (; data && offset != SIZE_MAX && parse(offset, node);)
+            {
+                size_t n = std::min(prefix.size(), node.prefix.size());
+                if (prefix.substr(0, n) != node.prefix.substr(0, n))
+                    return;
+
+                path += node.prefix;
+                if (prefix.size() <= node.prefix.size())
+                    break;
+
+                prefix.remove_prefix(n);
+                path += prefix[0];
+                offset = child(node, uint8_t(prefix[0]));
+                prefix.remove_prefix(1);
+            }
+
+            if (!data || offset == SIZE_MAX || !parse(offset, node))
+                return;
+
+            // Depth-first in label order: each entry is a node, the next child
+            // to visit and the path length without that child
+            std::vector<std::pair<Node, size_t>> stack;
+            stack.emplace_back(node, 0);
+
+            if (node.terminal && !detail::visitTrieKey(visit, path, node.value))
+                return;
+
+            while (!stack.empty())
+            {
+                auto& [parent, next] = stack.back();
+                if (next == parent.childCount)
+                {
+                    path.resize(path.size() - parent.prefix.size() - (stack.size() > 1));
+                    stack.pop_back();
+                    continue;
+                }
+
+                size_t i = next++;
+                Node child;
+                size_t childOffset = childAt(parent, i);
+                if (childOffset == SIZE_MAX || !parse(childOffset, child))
+                    return;
+
+                path += parent.labels[i];
+                path += child.prefix;
+                stack.emplace_back(child, 0);
+
+                if (child.terminal && !detail::visitTrieKey(visit, path, child.value))
+                    return;
+            }
+        }
+
+        template<typename Visit>
+        void forEach(Visit visit) const
+        {
+            forEachWithPrefix({}, visit);
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////////////////////
+    // Roaring sets
+    //////////////////////////////////////////////////////////////////////////////////
+    // Sets of unsigned integers of up to 32 bits, split into chunks of 65536
+    // values by their high 16 bits. Each chunk is stored as whichever is
+    // smallest: a sorted array of uint16 low bits, a 65536-bit bitmap or
+    // [uint16 run count][uint16 start, uint16 length - 1] runs. The image is
+    // [uint32 chunk count][chunk descriptors][containers].
+    namespace detail
+    {
+        enum class RoaringType : uint8_t
+        {
+            Array,
+            Bitmap,
+            Run,
+        };
+
+        struct RoaringChunk
+        {
+            uint16_t key;
+            RoaringType type;
+            uint8_t reserved;
+            uint32_t cardinality;
+            uint32_t offset;
+        };
+
+        static_assert(sizeof(RoaringChunk) == 12, "RoaringChunk is written as is");
+
+        constexpr size_t roaringBitmapWords = 1024;
+        constexpr size_t roaringBitmapBytes = roaringBitmapWords * sizeof(uint64_t);
+
+        template<typename T>
+        inline T loadRoaring(const char* at)
+        {
+            T value;
+            std::memcpy(&value, at, sizeof(T));
+            return value;
+        }
+
+        template<typename T>
+        inline void appendRoaring(std::string& image, T value)
+        {
+            image.append((const char*)&value, sizeof(T));
+        }
+
+        // values sorted and unique
+        inline std::string roaringImage(const uint32_t* values, size_t count)
+        {
+            size_t chunks = 0;
+            for (size_t i = 0; i < count; ++i)
+                chunks += i == 0 || (values[i] >> 16) != (values[i - 1] >> 16);
+
+            std::string image;
+            appendRoaring(image, uint32_t(chunks));
+            image.resize(sizeof(uint32_t) + chunks * sizeof(RoaringChunk));
+
+            for (size_t i = 0, c = 0, j; i < count; i = j, ++c)
+            {
+                uint32_t key = values[i] >> 16;
+                size_t runs = 1;
+                for (j = i + 1; j < count && (values[j] >> 16) == key; ++j)
+                    runs += values[j] != values[j - 1] + 1;
+
+                size_t arrayBytes = 2 * (j - i), runBytes = 2 + 4 * runs;
+                RoaringChunk chunk = { uint16_t(key), RoaringType::Array, 0, uint32_t(j - i), uint32_t(image.size()) };
+                if (runBytes < std::min(arrayBytes, roaringBitmapBytes))
+                    chunk.type = RoaringType::Run;
+                else if (arrayBytes > roaringBitmapBytes)
+                    chunk.type = RoaringType::Bitmap;
+                std::memcpy(image.data() + sizeof(uint32_t) + c * sizeof(RoaringChunk), &chunk, sizeof(chunk));
+
+                if (chunk.type == RoaringType::Array)
+                {
+                    for (size_t k = i; k < j; ++k)
+                        appendRoaring(image, uint16_t(values[k]));
+                }
+                else if (chunk.type == RoaringType::Bitmap)
+                {
+                    uint64_t words[roaringBitmapWords] = {};
+                    for (size_t k = i; k < j; ++k)
+                        words[(values[k] & 0xFFFF) >> 6] |= uint64_t(1) << (values[k] & 63);
+                    image.append((const char*)words, sizeof(words));
+                }
+                else
+                {
+                    appendRoaring(image, uint16_t(runs));
+                    for (size_t k = i, end; k < j; k = end)
+                    {
+                        for (end = k + 1; end < j && values[end] == values[end - 1] + 1; ++end)
+                            ;
+                        appendRoaring(image, uint16_t(values[k]));
+                        appendRoaring(image, uint16_t(end - k - 1));
+                    }
+                }
+            }
+
+            return image;
+        }
+    }
+
+    // Builds the roaring image of a std::set, std::unordered_set or similar of
+    // unsigned integers. Write it like any std::string.
+    template<typename C>
+    inline std::string encodeRoaring(const C& container)
+    {
+        using T = typename C::value_type;
+        static_assert(std::is_unsigned_v<T> && !std::is_same_v<T, bool> && sizeof(T) <= 4, "Roaring sets hold unsigned integers of up to 32 bits");
+
+        std::vector<uint32_t> values(container.begin(), container.end());
+        if (!std::is_sorted(values.begin(), values.end()))
+            std::sort(values.begin(), values.end());
+
+        return detail::roaringImage(values.data(), values.size());
+    }
+
+    // Membership, iteration and intersections on a roaring image where it
+    // lies, e.g. in a mapped file. The chunk table is checked up front; not
+    // valid() if any chunk reaches past the image.
+    class RoaringView
+    {
+        using Chunk = detail::RoaringChunk;
+        using Type = detail::RoaringType;
+
+        const char* data = nullptr;
+        size_t chunkCount = 0;
+        uint64_t count = 0;
+
+        Chunk chunk(size_t i) const
+        {
+            return detail::loadRoaring<Chunk>(data + sizeof(uint32_t) + i * sizeof(Chunk));
+        }
+
+        size_t find(uint16_t key) const
+        {
+            size_t low = 0, high = chunkCount;
+            while (low < high)
+            {
+                size_t middle = (low + high) / 2;
+                if (chunk(middle).key < key)
+                    low = middle + 1;
+                else
+                    high = middle;
+            }
+
+            return low < chunkCount && chunk(low).key == key ? low : SIZE_MAX;
+        }
+
+        uint16_t arrayAt(const Chunk& c, size_t i) const
+        {
+            return detail::loadRoaring<uint16_t>(data + c.offset + 2 * i);
+        }
+
+        uint16_t runCount(const Chunk& c) const
+        {
+            return detail::loadRoaring<uint16_t>(data + c.offset);
+        }
+
+        // Start and last value of run i
+        std::pair<uint32_t, uint32_t> runAt(const Chunk& c, size_t i) const
+        {
+            uint16_t start = detail::loadRoaring<uint16_t>(data + c.offset + 2 + 4 * i);
+            return { start, start + uint32_t(detail::loadRoaring<uint16_t>(data + c.offset + 4 + 4 * i)) };
+        }
+
+        bool chunkContains(const Chunk& c, uint16_t value) const
+        {
+            if (c.type == Type::Bitmap)
+                return (detail::loadRoaring<uint64_t>(data + c.offset + (value >> 6) * 8) >> (value & 63)) & 1;
+
+            size_t low = 0, high = c.type == Type::Array ? c.cardinality : runCount(c);
+            while (low < high)
+            {
+                size_t middle = (low + high) / 2;
+                if ((c.type == Type::Array ? arrayAt(c, middle) : runAt(c, middle).first) <= value)
+                    low = middle + 1;
+                else
+                    high = middle;
+            }
+
+            if (low == 0)
+                return false;
+            return c.type == Type::Array ? arrayAt(c, low - 1) == value : runAt(c, low - 1).second >= value;
+        }
+
+        template<typename Visit>
+        bool forEachInChunk(const Chunk& c, Visit& visit) const
+        {
+            uint32_t high = uint32_t(c.key) << 16;
+            if (c.type == Type::Array)
+            {
+                for (size_t i = 0; i < c.cardinality; ++i)
+                    if (!visitRoaring(visit, high | arrayAt(c, i)))
+                        return false;
+            }
+            else if (c.type == Type::Run)
+            {
+                for (size_t i = 0; i < runCount(c); ++i)
+                {
+                    auto [first, last] = runAt(c, i);
+                    for (uint32_t value = first; value <= last && value <= 0xFFFF; ++value)
+                        if (!visitRoaring(visit, high | value))
+                            return false;
+                }
+            }
+            else
+            {
+                for (size_t w = 0; w < detail::roaringBitmapWords; ++w)
+                    if (!visitWord(visit, high | uint32_t(w * 64), detail::loadRoaring<uint64_t>(data + c.offset + w * 8)))
+                        return false;
+            }
+
+            return true;
+        }
+
+        void toWords(const Chunk& c, uint64_t* words) const
+        {
+            if (c.type == Type::Bitmap)
+            {
+                std::memcpy(words, data + c.offset, detail::roaringBitmapBytes);
+                return;
+            }
+
+            std::fill(words, words + detail::roaringBitmapWords, 0);
+            for (size_t i = 0; i < runCount(c); ++i)
+            {
+                auto [first, last] = runAt(c, i);
+                for (uint32_t value = first; value <= last && value <= 0xFFFF; ++value)
+                    words[value >> 6] |= uint64_t(1) << (value & 63);
+            }
+        }
+
+        // visit returns void, or false to stop
+        template<typename Visit>
+        static bool visitRoaring(Visit& visit, uint32_t value)
+        {
+            if constexpr (std::is_void_v<std::invoke_result_t<Visit&, uint32_t>>)
+            {
+                visit(value);
+                return true;
+            }
+            else
+            {
+                return bool(visit(value));
+            }
+        }
+
+        template<typename Visit>
+        static bool visitWord(Visit& visit, uint32_t base, uint64_t word)
+        {
+            for (; word != 0; word &= word - 1)
+                if (!visitRoaring(visit, base | uint32_t(std::countr_zero(word))))
+                    return false;
+
+            return true;
+        }
+
+        // Arrays are probed value by value; bitmaps and runs are ANDed as words
+        template<typename Visit>
+        bool intersectChunks(const Chunk& a, const RoaringView& other, const Chunk& b, Visit& visit) const
+        {
+            uint32_t high = uint32_t(a.key) << 16;
+            if (a.type == Type::Array && (b.type != Type::Array || a.cardinality <= b.cardinality))
+            {
+                for (size_t i = 0; i < a.cardinality; ++i)
+                    if (uint16_t value = arrayAt(a, i); other.chunkContains(b, value) && !visitRoaring(visit, high | value))
+                        return false;
+                return true;
+            }
+
+            if (b.type == Type::Array)
+                return other.intersectChunks(b, *this, a, visit);
+
+            uint64_t left[detail::roaringBitmapWords], right[detail::roaringBitmapWords];
+            toWords(a, left);
+            other.toWords(b, right);
+
+            for (size_t w = 0; w < detail::roaringBitmapWords; ++w)
+                if (!visitWord(visit, high | uint32_t(w * 64), left[w] & right[w]))
+                    return false;
+
+            return true;
+        }
+
+    public:
+        RoaringView() = default;
+
+        RoaringView(const void* image, size_t size)
+        {
+            if (size < sizeof(uint32_t))
+                return;
+
+            const char* bytes = (const char*)image;
+            uint64_t chunks = detail::loadRoaring<uint32_t>(bytes);
+            if (chunks > (size - sizeof(uint32_t)) / sizeof(Chunk))
+                return;
+
+            data = bytes;
+            chunkCount = size_t(chunks);
+            for (size_t i = 0; i < chunkCount; ++i)
+            {
+                Chunk c = chunk(i);
+                uint64_t length = c.type == Type::Array ? 2 * uint64_t(c.cardinality)
+                    : c.type == Type::Bitmap ? detail::roaringBitmapBytes
+                    : uint64_t(c.offset) + 2 <= size ? 2 + 4 * uint64_t(runCount(c)) : 2;
+
+                bool ordered = i == 0 || chunk(i - 1).key < c.key;
+                if (!ordered || c.type > Type::Run || c.cardinality == 0 || c.cardinality > 65536 || uint64_t(c.offset) + length > size)
+                {
+                    data = nullptr;
+                    chunkCount = 0;
+                    count = 0;
+                    return;
+                }
+
+                count += c.cardinality;
+            }
+        }
+
+        explicit RoaringView(const std::string& image)
+            : RoaringView(image.data(), image.size())
+        {
+        }
+
+        bool valid() const
+        {
+            return data != nullptr;
+        }
+
+        uint64_t size() const
+        {
+            return count;
+        }
+
+        bool contains(uint32_t value) const
+        {
+            size_t i = find(uint16_t(value >> 16));
+            return i != SIZE_MAX && chunkContains(chunk(i), uint16_t(value));
+        }
+
+        // Calls visit(uint32_t) in increasing order, until it returns false
+        template<typename Visit>
+        void forEach(Visit visit) const
+        {
+            for (size_t i = 0; i < chunkCount; ++i)
+                if (!forEachInChunk(chunk(i), visit))
+                    return;
+        }
+
+        // Calls visit(uint32_t) for each value in both sets, in increasing
+        // order, until it returns false. Only chunks present in both are read.
+        template<typename Visit>
+        void forEachInIntersection(const RoaringView& other, Visit visit) const
+        {
+            for (size_t i = 0, j = 0; i < chunkCount && j < other.chunkCount;)
+            {
+                Chunk a = chunk(i), b = other.chunk(j);
+                if (a.key < b.key)
+                {
+                    ++i;
+                }
+                else if (b.key < a.key)
+                {
+                    ++j;
+                }
+                else
+                {
+                    if (!intersectChunks(a, other, b, visit))
+                        return;
+                    ++i, ++j;
+                }
+            }
+        }
+
+        uint64_t intersectionSize(const RoaringView& other) const
+        {
+            uint64_t size = 0;
+            forEachInIntersection(other, [&](uint32_t) { ++size; });
+            return size;
+        }
+    };
+
+    // Streams a set of unsigned integers as a roaring image, on both the
+    // write and the read. The bytes are those of writer << encodeRoaring(set),
+    // so a RoaringView can read them in place too.
+    template<typename C>
+    struct Roaring
+    {
+        C& container;
+    };
+
+    template<typename C>
+    inline Roaring<C> roaring(C& container)
+    {
+        return { container };
+    }
+
+    template<typename C>
+    inline SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const Roaring<C>& object)
+    {
+        writer << encodeRoaring(object.container);
+        return writer;
+    }
+
+    template<typename C>
+    inline SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, Roaring<C> object)
+    {
+        static_assert(!std::is_const_v<C>, "Reading needs a mutable container");
+        using T = typename C::value_type;
+
+        std::string image;
+        reader >> image;
+
+        RoaringView view(image);
+        if (!reader.stream || !view.valid())
+        {
+            reader.stream.setstate(std::ios::failbit);
+            return reader;
+        }
+
+        if constexpr (requires { object.container.reserve(0); })
+            object.container.reserve(object.container.size() + size_t(view.size()));
+
+        view.forEach([&](uint32_t value) { object.container.emplace_hint(object.container.end(), T(value)); });
+        return reader;
+    }
+
+    //////////////////////////////////////////////////////////////////////////////////
+    // Fan-out
+    //////////////////////////////////////////////////////////////////////////////////
+    namespace detail
+    {
+        // Encoded bytes fill a ring of blocks; each destination drains the ring
+        // on its own thread, in order. A block is refilled once every destination
+        // has written it, so the slowest one can fall at most queueDepth blocks
+        // behind before the encoder waits, and never holds up the others.
+        class TeeBuffer : public std::streambuf
+        {
+            struct Block
+            {
+                std::unique_ptr<char[]> data;
+                size_t size = 0;
+            };
+
+            struct Destination
+            {
+                std::streambuf* target;
+                uint64_t next = 0; // Sequence number of the next block to write
+                bool failed = false;
+                std::thread worker;
+            };
+
+            std::vector<Block> ring;
+            std::vector<Destination> destinations;
+            size_t blockSize;
+            uint64_t published = 0;
+            bool stopping = false;
+            std::mutex lock;
+            std::condition_variable changed;
+
+            Block& blockFor(uint64_t sequence)
+            {
+                return ring[size_t(sequence % ring.size())];
+            }
+
+            bool isFree(uint64_t sequence) const
+            {
+                for (auto&& destination : destinations)
+                    if (destination.next + ring.size() <= sequence)
+                        return false;
+
+                return true;
+            }
+
+            void drain(Destination& destination)
+            {
+                std::unique_lock<std::mutex> guard(lock);
+
+                for (;;)
+                {
+                    changed.wait(guard, [&] { return stopping || destination.next < published; });
+                    if (destination.next == published)
+                        return;
+
+                    Block& block = blockFor(destination.next);
+                    guard.unlock();
+
+                    bool written = destination.failed || destination.target->sputn(block.data.get(), std::streamsize(block.size)) == std::streamsize(block.size);
+
+                    guard.lock();
+                    destination.failed |= !written;
+                    ++destination.next;
+                    changed.notify_all();
+                }
+            }
+
+            // Hands the filled part of the current block to every destination
+            // and moves on to the next free one
+            void publish()
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                blockFor(published).size = size_t(pptr() - pbase());
+                ++published;
+                changed.notify_all();
+
+                changed.wait(guard, [&] { return isFree(published); });
+                char* next = blockFor(published).data.get();
+                setp(next, next + blockSize);
+            }
+
+        public:
+            TeeBuffer(const std::vector<std::streambuf*>& targets, size_t blockSize, size_t queueDepth)
+                : ring(std::max<size_t>(queueDepth, 1) + 1), blockSize(std::max<size_t>(blockSize, 1))
+            {
+                for (auto&& block : ring)
+                    block.data = std::make_unique<char[]>(this->blockSize);
+
+                destinations.resize(targets.size());
+                for (size_t i = 0; i < targets.size(); ++i)
+                    destinations[i].target = targets[i];
+
+                for (auto&& destination : destinations)
+                    destination.worker = std::thread([this, &destination] { drain(destination); });
+
+                setp(ring[0].data.get(), ring[0].data.get() + this->blockSize);
+            }
+
+            ~TeeBuffer()
+            {
+                sync();
+
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    stopping = true;
+                }
+
+                changed.notify_all();
+                for (auto&& destination : destinations)
+                    destination.worker.join();
+            }
+
+        protected:
+            int_type overflow(int_type ch) override
+            {
+                publish();
+
+                if (!traits_type::eq_int_type(ch, traits_type::eof()))
+                {
+                    *pptr() = traits_type::to_char_type(ch);
+                    pbump(1);
+                }
+
+                return traits_type::not_eof(ch);
+            }
+
+            std::streamsize xsputn(const char* source, std::streamsize count) override
+            {
+                for (std::streamsize done = 0; done < count;)
+                {
+                    if (pptr() == epptr())
+                        publish();
+
+                    std::streamsize step = std::min<std::streamsize>(count - done, epptr() - pptr());
+                    std::memcpy(pptr(), source + done, size_t(step));
+                    pbump(int(step));
+                    done += step;
+                }
+
+                return count;
+            }
+
+            // Waits until every destination has written everything, then syncs them
+            int sync() override
+            {
+                if (pptr() != pbase())
+                    publish();
+
+                std::unique_lock<std::mutex> guard(lock);
+                changed.wait(guard, [&]
+                {
+                    return std::all_of(destinations.begin(), destinations.end(), [&](auto&& destination) { return destination.next == published; });
+                });
+
+                bool ok = true;
+                for (auto&& destination : destinations)
+                    ok &= !destination.failed && destination.target->pubsync() == 0;
+
+                return ok ? 0 : -1;
+            }
+        };
+    }
+
+    // Encodes once and writes the same bytes to several stream buffers (a file,
+    // a MemoryBuffer, a socket...), each from its own thread with its own
+    // buffering. The stream goes bad on flush if any destination failed.
+    class TeeWriter : private detail::TeeBuffer, public SerBin<std::ios::out>
+    {
+    public:
+        // Destinations must outlive the writer
+        explicit TeeWriter(const std::vector<std::streambuf*>& destinations, size_t blockSize = 64 << 10, size_t queueDepth = 8)
+            : detail::TeeBuffer(destinations, blockSize, queueDepth), SerBin<std::ios::out>(static_cast<std::streambuf&>(*this))
+        {
+        }
+
+        // Everything written so far has reached every destination
+        bool finish()
+        {
+            stream.flush();
+            return stream.good();
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////////////////////
+    // Record files
+    //////////////////////////////////////////////////////////////////////////////////
+    // An append-only file of records, each framed as [uint64 size][encoded object].
+    // A record is encoded in memory and written in one piece, so a reader that
+    // sees its size also sees every byte before it.
+    //
+    // Optionally, every indexStride-th record also gets a [uint64 key][uint64
+    // offset] entry in <filename>.idx, for a key that grows monotonically with
+    // the records (a timestamp, a sequence number), so readers can seek by key.
+    class RecordWriter
+    {
+        std::filebuf file;
+        std::filebuf index;
+        MemoryBuffer payload;
+        SerBin<std::ios::out> encoder{ payload };
+        bool flushEachRecord;
+        size_t indexStride;
+        size_t sinceIndexed;
+        uint64_t offset = 0;
+
+        bool appendRecord(std::optional<uint64_t> key)
+        {
+            uint64_t size = payload.size();
+            bool written = file.sputn((const char*)&size, sizeof(size)) == sizeof(size)
+                && file.sputn(payload.data(), std::streamsize(size)) == std::streamsize(size);
+
+            if (key && ++sinceIndexed >= indexStride)
+            {
+                uint64_t entry[2] = { *key, offset };
+                written &= index.sputn((const char*)entry, sizeof(entry)) == sizeof(entry);
+                sinceIndexed = 0;
+            }
+
+            offset += sizeof(size) + size;
+
+            if (flushEachRecord)
+                flush();
+
+            return written && encoder.stream.good();
+        }
+
+    public:
+        // flushEachRecord makes records visible to tailing readers right away;
+        // indexStride 0 keeps no index
+        explicit RecordWriter(const std::string& filename, bool flushEachRecord = true, size_t indexStride = 0)
+            : flushEachRecord(flushEachRecord), indexStride(indexStride), sinceIndexed(indexStride)
+        {
+            if (file.open(filename, std::ios::out | std::ios::app | std::ios::binary))
+                offset = uint64_t(std::streamoff(file.pubseekoff(0, std::ios::end, std::ios::out)));
+
+            if (indexStride > 0)
+                index.open(filename + ".idx", std::ios::out | std::ios::app | std::ios::binary);
+        }
+
+        bool isOpen() const
+        {
+            return file.is_open() && (indexStride == 0 || index.is_open());
+        }
+
+        template<typename T>
+        bool append(const T& object)
+        {
+            payload.clear();
+            encoder << object;
+            return appendRecord({});
+        }
+
+        // key must not decrease from one record to the next
+        template<typename T>
+        bool append(const T& object, uint64_t key)
+        {
+            payload.clear();
+            encoder << object;
+            return appendRecord(indexStride > 0 ? std::optional<uint64_t>(key) : std::nullopt);
+        }
+
+        // The log first, so no index entry points past visible records
+        void flush()
+        {
+            file.pubsync();
+            index.pubsync();
+        }
+    };
+
+    namespace detail
+    {
+        // Offset of the last indexed record whose key is below key, or 0: a
+        // binary search with positional reads, without loading the index
+        inline uint64_t indexedOffsetBefore(const std::string& indexFilename, uint64_t key)
+        {
+            FileHandle index = openForReading(indexFilename);
+            if (index == invalidFile)
+                return 0;
+
+            uint64_t entry[2];
+            uint64_t low = 0, high = fileSize(index) / sizeof(entry);
+            while (low < high)
+            {
+                uint64_t middle = low + (high - low) / 2;
+                if (readAt(index, middle * sizeof(entry), (char*)entry, sizeof(entry)) == sizeof(entry) && entry[0] < key)
+                    low = middle + 1;
+                else
+                    high = middle;
+            }
+
+            uint64_t offset = 0;
+            if (low > 0 && readAt(index, (low - 1) * sizeof(entry), (char*)entry, sizeof(entry)) == sizeof(entry))
+                offset = entry[1];
+
+            closeFile(index);
+            return offset;
+        }
+    }
+
+    // Follows a record file as it grows, like tail -f, yielding complete records
+    // only. Waiting spins briefly, then blocks on inotify where available and
+    // backs off with sleeps elsewhere.
+    class TailReader
+    {
+        std::string filename;
+        detail::FileHandle handle = detail::invalidFile;
+        uint64_t offset;
+        MemoryBuffer payload;
+        int notifier = -1;
+
+        static constexpr int spinChecks = 64;
+        static constexpr auto longestSleep = std::chrono::milliseconds(10);
+
+        bool tryOpen()
+        {
+            if (handle != detail::invalidFile)
+                return true;
+
+            handle = detail::openForReading(filename);
+#if defined(__linux__)
+            if (handle != detail::invalidFile)
+            {
+                notifier = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+                if (notifier >= 0 && inotify_add_watch(notifier, filename.c_str(), IN_MODIFY | IN_CLOSE_WRITE) < 0)
+                {
+                    ::close(notifier);
+                    notifier = -1;
+                }
+            }
+#endif
+            return handle != detail::invalidFile;
+        }
+
+        // Payload of the record at offset, if all of it is in the file yet
+        bool tryLoad()
+        {
+            if (!tryOpen())
+                return false;
+
+            uint64_t fileSize = detail::fileSize(handle);
+            uint64_t size;
+            if (fileSize < offset || fileSize - offset < sizeof(size) || detail::readAt(handle, offset, (char*)&size, sizeof(size)) != sizeof(size))
+                return false;
+
+            // A torn tail may hold any length: only allocate for what the file has
+            if (fileSize - offset - sizeof(size) < size)
+                return false;
+
+            payload.clear();
+            if (detail::readAt(handle, offset + sizeof(size), payload.prepare(size_t(size)), size_t(size)) != size)
+                return false;
+
+            payload.commit(size_t(size));
+            offset += sizeof(size) + size;
+            return true;
+        }
+
+        void wait(std::chrono::steady_clock::time_point deadline, int round)
+        {
+            if (round < spinChecks)
+            {
+                std::this_thread::yield();
+                return;
+            }
+
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            auto slice = std::clamp(left, std::chrono::milliseconds(0), longestSleep * 100);
+
+#if defined(__linux__)
+            if (notifier >= 0)
+            {
+                pollfd watched = { notifier, POLLIN, 0 };
+                if (poll(&watched, 1, int(slice.count())) > 0)
+                {
+                    char events[4096];
+                    while (::read(notifier, events, sizeof(events)) > 0)
+                        ;
+                }
+                return;
+            }
+#endif
+            auto backoff = std::chrono::microseconds(50 << std::min(round - spinChecks, 8));
+            std::this_thread::sleep_for(std::min<std::chrono::microseconds>({ backoff, longestSleep, slice }));
+        }
+
+    public:
+        explicit TailReader(std::string filename, uint64_t offset = 0)
+            : filename(std::move(filename)), offset(offset)
+        {
+            tryOpen();
+        }
+
+        ~TailReader()
+        {
+            if (handle != detail::invalidFile)
+                detail::closeFile(handle);
+#if defined(__linux__)
+            if (notifier >= 0)
+                ::close(notifier);
+#endif
+        }
+
+        TailReader(const TailReader&) = delete;
+        TailReader& operator=(const TailReader&) = delete;
+
+        // Offset of the next record; a later TailReader can resume from it
+        uint64_t position() const
+        {
+            return offset;
+        }
+
+        void seek(uint64_t position)
+        {
+            offset = position;
+        }
+
+        // Positions next() at the first record with keyOf(record) >= key. The
+        // <filename>.idx index written by RecordWriter narrows this to a scan of
+        // at most its stride; without one, the whole file is scanned. False if
+        // no such record exists yet, leaving next() at the end of the file.
+        template<typename T, typename KeyOf>
+        bool seekToKey(uint64_t key, KeyOf keyOf)
+        {
+            offset = detail::indexedOffsetBefore(filename + ".idx", key);
+
+            for (uint64_t start = offset; tryLoad(); start = offset)
+            {
+                // Fresh each time: container overloads append to what's there
+                T object;
+                SerBin<std::ios::in> decoder(payload);
+                decoder >> object;
+
+                if (decoder.stream && uint64_t(keyOf(object)) >= key)
+                {
+                    offset = start;
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        // Decodes the next record, waiting up to timeout for it to be complete
+        template<typename T, typename Rep = int64_t, typename Period = std::milli>
+        bool next(T& object, std::chrono::duration<Rep, Period> timeout = std::chrono::hours(24 * 365))
+        {
+            auto deadline = std::chrono::steady_clock::now() + timeout;
+
+            for (int round = 0; !tryLoad(); ++round)
+            {
+                if (std::chrono::steady_clock::now() >= deadline)
+                    return false;
+
+                wait(deadline, round);
+            }
+
+            SerBin<std::ios::in> decoder(payload);
+            decoder >> object;
+            return bool(decoder.stream);
+        }
+
+        template<typename T>
+        bool tryNext(T& object)
+        {
+            return next(object, std::chrono::milliseconds(0));
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////////////////////
+    // Hashing
+    //////////////////////////////////////////////////////////////////////////////////
+    namespace detail
+    {
+        // XXH64, streaming
+        class XXHash64
+        {
+            static constexpr uint64_t prime1 = 0x9E3779B185EBCA87ull;
+            static constexpr uint64_t prime2 = 0xC2B2AE3D27D4EB4Full;
+            static constexpr uint64_t prime3 = 0x165667B19E3779F9ull;
+            static constexpr uint64_t prime4 = 0x85EBCA77C2B2AE63ull;
+            static constexpr uint64_t prime5 = 0x27D4EB2F165667C5ull;
+
+            uint64_t lanes[4];
+            uint64_t seed;
+            uint64_t total = 0;
+            unsigned char pending[32];
+            size_t pendingSize = 0;
+
+            static uint64_t read64(const unsigned char* bytes)
+            {
+                uint64_t value;
+                std::memcpy(&value, bytes, sizeof(value));
+                return value;
+            }
+
+            static uint32_t read32(const unsigned char* bytes)
+            {
+                uint32_t value;
+                std::memcpy(&value, bytes, sizeof(value));
+                return value;
+            }
+
+            static uint64_t round(uint64_t lane, uint64_t input)
+            {
+                return std::rotl(lane + input * prime2, 31) * prime1;
+            }
+
+            static uint64_t merge(uint64_t hash, uint64_t lane)
+            {
+                return (hash ^ round(0, lane)) * prime1 + prime4;
+            }
+
+            void consume(const unsigned char* stripe)
+            {
+                for (int i = 0; i < 4; ++i)
+                    lanes[i] = round(lanes[i], read64(stripe + i * 8));
+            }
+
+        public:
+            explicit XXHash64(uint64_t seed = 0)
+                : lanes{ seed + prime1 + prime2, seed + prime2, seed, seed - prime1 }, seed(seed)
+            {
+            }
+
+            void update(const void* data, size_t size)
+            {
+                auto bytes = (const unsigned char*)data;
+                total += size;
+
+                if (pendingSize + size < 32)
+                {
+                    std::memcpy(pending + pendingSize, bytes, size);
+                    pendingSize += size;
+                    return;
+                }
+
+                if (pendingSize > 0)
+                {
+                    size_t fill = 32 - pendingSize;
+                    std::memcpy(pending + pendingSize, bytes, fill);
+                    consume(pending);
+                    bytes += fill;
+                    size -= fill;
+                    pendingSize = 0;
+                }
+
+                for (; size >= 32; bytes += 32, size -= 32)
+                    consume(bytes);
+
+                std::memcpy(pending, bytes, size);
+                pendingSize = size;
+            }
+
+            uint64_t digest() const
+            {
+                uint64_t hash;
+                if (total >= 32)
+                {
+                    hash = std::rotl(lanes[0], 1) + std::rotl(lanes[1], 7) + std::rotl(lanes[2], 12) + std::rotl(lanes[3], 18);
+                    for (uint64_t lane : lanes)
+                        hash = merge(hash, lane);
+                }
+                else
+                {
+                    hash = seed + prime5;
+                }
+
+                hash += total;
+
+                const unsigned char* tail = pending;
+                size_t left = pendingSize;
+                for (; left >= 8; tail += 8, left -= 8)
+                    hash = std::rotl(hash ^ round(0, read64(tail)), 27) * prime1 + prime4;
+                if (left >= 4)
+                {
+                    hash = std::rotl(hash ^ (read32(tail) * prime1), 23) * prime2 + prime3;
+                    tail += 4;
+                    left -= 4;
+                }
+                for (; left > 0; ++tail, --left)
+                    hash = std::rotl(hash ^ (*tail * prime5), 11) * prime1;
+
+                hash ^= hash >> 33;
+                hash *= prime2;
+                hash ^= hash >> 29;
+                hash *= prime3;
+                hash ^= hash >> 32;
+                return hash;
+            }
+        };
+
+        inline uint64_t xxhash64(const void* data, size_t size, uint64_t seed = 0)
+        {
+            XXHash64 hash(seed);
+            hash.update(data, size);
+            return hash.digest();
+        }
+
+        // Runs work(i) for i in [0, count) on up to threads threads
+        template<typename Work>
+        inline void parallelFor(size_t count, unsigned threads, Work&& work)
+        {
+            threads = unsigned(std::min<size_t>(std::max(threads, 1u), count));
+            if (threads <= 1)
+            {
+                for (size_t i = 0; i < count; ++i)
+                    work(i);
+                return;
+            }
 
-        for (auto&& value : object)
-            writer << value;
+            std::vector<std::thread> workers;
+            for (unsigned t = 1; t < threads; ++t)
+            {
+                workers.emplace_back([&, t]
+                {
+                    for (size_t i = t; i < count; i += threads)
+                        work(i);
+                });
+            }
 
-        return writer;
-    }
+            for (size_t i = 0; i < count; i += threads)
+                work(i);
 
-    template<typename T>
-    inline SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, std::set<T>& object)
-    {
-        decltype(object.size()) s;
-        reader >> s;
+            for (auto&& worker : workers)
+                worker.join();
+        }
 
-        for (decltype(s) i = 0; i < s; ++i)
+        inline unsigned defaultThreads()
         {
-            T value;
-            reader >> value;
-            object.insert(std::move(value));
+            return std::clamp(std::thread::hardware_concurrency(), 1u, 16u);
         }
-
-        return reader;
     }
 
-    // std::unordered_set
-    template<typename T>
-    inline SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const std::unordered_set<T>& object)
+    // Feeds everything written to it into XXH64 through a small staging block,
+    // so an encoding can be hashed without being kept anywhere. Usable on its
+    // own, as a TeeWriter destination, or through HashWriter.
+    class HashBuffer : public std::streambuf
     {
-        writer << object.size();
+        static constexpr size_t stagingSize = 512;
 
-        for (auto&& value : object)
-            writer << value;
+        detail::XXHash64 hash;
+        uint64_t seed;
+        char staging[stagingSize];
 
-        return writer;
-    }
+        void flushStaging()
+        {
+            hash.update(pbase(), size_t(pptr() - pbase()));
+            setp(staging, staging + stagingSize);
+        }
 
-    template<typename T>
-    inline SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, std::unordered_set<T>& object)
-    {
-        decltype(object.size()) s;
-        reader >> s;
+    public:
+        explicit HashBuffer(uint64_t seed = 0)
+            : hash(seed), seed(seed)
+        {
+            setp(staging, staging + stagingSize);
+        }
 
-        for (decltype(s) i = 0; i < s; ++i)
+        // Of everything written since construction or reset(); more can follow
+        uint64_t digest()
         {
-            T value;
-            reader >> value;
-            object.insert(std::move(value));
+            flushStaging();
+            return hash.digest();
         }
 
-        return reader;
-    }
+        void reset()
+        {
+            hash = detail::XXHash64(seed);
+            setp(staging, staging + stagingSize);
+        }
 
-    // std::pair
-    template<typename T0, typename T1>
-    inline SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const std::pair<T0, T1>& object)
+    protected:
+        int_type overflow(int_type ch) override
+        {
+            flushStaging();
+
+            if (!traits_type::eq_int_type(ch, traits_type::eof()))
+            {
+                *pptr() = traits_type::to_char_type(ch);
+                pbump(1);
+            }
+
+            return traits_type::not_eof(ch);
+        }
+
+        // Large writes skip the staging block
+        std::streamsize xsputn(const char* source, std::streamsize count) override
+        {
+            if (count <= epptr() - pptr())
+            {
+                std::memcpy(pptr(), source, size_t(count));
+                pbump(int(count));
+            }
+            else
+            {
+                flushStaging();
+                hash.update(source, size_t(count));
+            }
+
+            return count;
+        }
+    };
+
+    // Hashes an object's encoding as it is written, e.g. for change detection:
+    //   writer.reset(); writer << state; if (writer.digest() != last) ...
+    class HashWriter : private HashBuffer, public SerBin<std::ios::out>
     {
-        writer << object.first << object.second;
-        return writer;
-    }
+    public:
+        explicit HashWriter(uint64_t seed = 0)
+            : HashBuffer(seed), SerBin<std::ios::out>(static_cast<std::streambuf&>(*this))
+        {
+        }
 
-    template<typename T0, typename T1>
-    inline SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, std::pair<T0, T1>& object)
+        using HashBuffer::digest;
+
+        void reset()
+        {
+            HashBuffer::reset();
+            stream.clear();
+        }
+    };
+
+    // XXH64 of what writer << object would write
+    template<typename T>
+    inline uint64_t hashOf(const T& object, uint64_t seed = 0)
     {
-        reader >> object.first >> object.second;
-        return reader;
+        HashWriter writer(seed);
+        writer << object;
+        return writer.digest();
     }
 
-    // std::map
-    template<typename K, typename V>
-    inline SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const std::map<K, V>& object)
+    //////////////////////////////////////////////////////////////////////////////////
+    // Integrity
+    //////////////////////////////////////////////////////////////////////////////////
+    // A Merkle file is the plain SerBin encoding, hashed as a tree of fixed-size
+    // chunks, followed by a footer:
+    //   [uint64 chunk hash]...[chunk size][data size][root hash][magic]
+    // Chunk hashes are XXH64 of the chunk and a parent is XXH64 (seed 1) of its
+    // two children, so any chunk can be checked against the root on its own.
+    namespace detail
     {
-        writer << object.size();
+        constexpr uint64_t merkleMagic = 0x454C4B52454D4253ull; // "SBMERKLE" on disk
+        constexpr size_t merkleTrailerWords = 4;
 
-        for (auto&& kv : object)
-            writer << kv;
+        inline uint64_t merkleRoot(std::vector<uint64_t> level)
+        {
+            if (level.empty())
+                return xxhash64("", 0);
 
-        return writer;
+            while (level.size() > 1)
+            {
+                size_t parents = (level.size() + 1) / 2;
+                for (size_t i = 0; i < parents; ++i)
+                    level[i] = 2 * i + 1 < level.size() ? xxhash64(&level[2 * i], 2 * sizeof(uint64_t), 1) : level[2 * i];
+
+                level.resize(parents);
+            }
+
+            return level[0];
+        }
+
+        // Holds a batch of chunks as its put area; a full batch is hashed in
+        // parallel, then written out
+        class MerkleBuffer : public std::streambuf
+        {
+            std::filebuf file;
+            size_t chunkSize;
+            unsigned threads;
+            std::vector<char> batch;
+            std::vector<uint64_t> leaves;
+            uint64_t dataSize = 0;
+            bool finished = false;
+
+        protected:
+            bool flushBatch()
+            {
+                size_t size = size_t(pptr() - pbase());
+                size_t first = leaves.size();
+                leaves.resize(first + (size + chunkSize - 1) / chunkSize);
+
+                parallelFor(leaves.size() - first, threads, [&](size_t i)
+                {
+                    size_t start = i * chunkSize;
+                    leaves[first + i] = xxhash64(batch.data() + start, std::min(chunkSize, size - start));
+                });
+
+                dataSize += size;
+                setp(batch.data(), batch.data() + batch.size());
+                return file.sputn(batch.data(), std::streamsize(size)) == std::streamsize(size);
+            }
+
+            int_type overflow(int_type ch) override
+            {
+                if (finished || !flushBatch())
+                    return traits_type::eof();
+
+                if (!traits_type::eq_int_type(ch, traits_type::eof()))
+                    sputc(traits_type::to_char_type(ch));
+
+                return traits_type::not_eof(ch);
+            }
+
+        public:
+            // A chunk size or thread count of 0 counts as 1
+            MerkleBuffer(const std::string& filename, size_t chunkSize, unsigned threads)
+                : chunkSize(std::max<size_t>(chunkSize, 1)), threads(std::max(threads, 1u)), batch(this->chunkSize * this->threads * 2)
+            {
+                file.open(filename, std::ios::out | std::ios::trunc | std::ios::binary);
+                setp(batch.data(), batch.data() + batch.size());
+            }
+
+            // Hashes what is left and writes the footer
+            bool finish()
+            {
+                if (finished)
+                    return true;
+
+                finished = true;
+                bool written = file.is_open() && flushBatch();
+
+                uint64_t trailer[merkleTrailerWords] = { chunkSize, dataSize, merkleRoot(leaves), merkleMagic };
+                written &= file.sputn((const char*)leaves.data(), std::streamsize(leaves.size() * sizeof(uint64_t))) == std::streamsize(leaves.size() * sizeof(uint64_t));
+                written &= file.sputn((const char*)trailer, sizeof(trailer)) == sizeof(trailer);
+                setp(nullptr, nullptr);
+                return file.close() && written;
+            }
+        };
     }
 
-    template<typename K, typename V>
-    inline SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, std::map<K, V>& object)
+    // Writes a Merkle file: use it like any SerBin<std::ios::out>, then finish()
+    // (or let the destructor do it) to write the footer.
+    class MerkleWriter : private detail::MerkleBuffer, public SerBin<std::ios::out>
     {
-        decltype(object.size()) s;
-        reader >> s;
+    public:
+        explicit MerkleWriter(const std::string& filename, size_t chunkSize = 256 << 10, unsigned threads = detail::defaultThreads())
+            : detail::MerkleBuffer(filename, chunkSize, threads), SerBin<std::ios::out>(static_cast<std::streambuf&>(*this))
+        {
+        }
 
-        for (decltype(s) i = 0; i < s; ++i)
+        ~MerkleWriter()
         {
-            std::pair<K, V> kv;
-            reader >> kv;
-            object.emplace(std::move(kv));
+            finish();
         }
 
-        return reader;
-    }
+        bool finish()
+        {
+            return detail::MerkleBuffer::finish() && stream.good();
+        }
+    };
 
-    // std::unordered_map
-    template<typename K, typename V>
-    inline SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const std::unordered_map<K, V>& object)
+    // Read side of a Merkle file. The chunk table is checked against the root on
+    // open; after that, any range can be verified on its own, in parallel, and
+    // a Cursor verifies each chunk it reads before handing out its bytes.
+    class MerkleFile
     {
-        writer << object.size();
+        detail::FileHandle handle;
+        uint64_t chunkSize = 0;
+        uint64_t dataSize = 0;
+        std::vector<uint64_t> leaves;
+        bool intact = false;
 
-        for (auto&& kv : object)
-            writer << kv;
+    public:
+        class Cursor;
 
-        return writer;
-    }
+        explicit MerkleFile(const std::string& filename)
+            : handle(detail::openForReading(filename))
+        {
+            if (handle == detail::invalidFile)
+                return;
 
-    template<typename K, typename V>
-    inline SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, std::unordered_map<K, V>& object)
-    {
-        decltype(object.size()) s;
-        reader >> s;
+            uint64_t fileSize = detail::fileSize(handle);
+            uint64_t trailer[detail::merkleTrailerWords];
+            if (fileSize < sizeof(trailer) || detail::readAt(handle, fileSize - sizeof(trailer), (char*)trailer, sizeof(trailer)) != sizeof(trailer))
+                return;
 
-        for (decltype(s) i = 0; i < s; ++i)
+            chunkSize = trailer[0];
+            dataSize = trailer[1];
+            if (trailer[3] != detail::merkleMagic || chunkSize == 0)
+                return;
+
+            uint64_t chunks = (dataSize + chunkSize - 1) / chunkSize;
+            if (dataSize + (chunks * sizeof(uint64_t)) + sizeof(trailer) != fileSize)
+                return;
+
+            leaves.resize(size_t(chunks));
+            size_t tableSize = leaves.size() * sizeof(uint64_t);
+            intact = detail::readAt(handle, dataSize, (char*)leaves.data(), tableSize) == tableSize && detail::merkleRoot(leaves) == trailer[2];
+        }
+
+        ~MerkleFile()
         {
-            std::pair<K, V> kv;
-            reader >> kv;
-            object.emplace(std::move(kv));
+            if (handle != detail::invalidFile)
+                detail::closeFile(handle);
         }
 
-        return reader;
-    }
+        MerkleFile(const MerkleFile&) = delete;
+        MerkleFile& operator=(const MerkleFile&) = delete;
 
-    // std::tuple
-    template<int id = 0, typename... Ts>
-    inline SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const std::tuple<Ts...>& object)
-    {
-        if constexpr (id < std::tuple_size_v<std::tuple<Ts...>>)
+        // Footer present and chunk table consistent with the root
+        bool isIntact() const
         {
-            writer << std::get<id>(object);
-            operator<<<id + 1>(writer, object);
+            return intact;
         }
 
-        return writer;
-    }
+        uint64_t size() const
+        {
+            return dataSize;
+        }
 
-    template<int id = 0, typename... Ts>
-    inline SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, std::tuple<Ts...>& object)
-    {
-        if constexpr (id < std::tuple_size_v<std::tuple<Ts...>>)
+        uint64_t chunk() const
         {
-            reader >> std::get<id>(object);
-            operator>><id + 1>(reader, object);
+            return chunkSize;
         }
 
-        return reader;
-    }
+        // Reads chunk index into target (chunk() bytes), returning its length if it matches its hash
+        std::optional<size_t> readChunk(uint64_t index, char* target) const
+        {
+            if (!intact || index >= leaves.size())
+                return {};
 
-    // std::optional
-    template<typename T>
-    inline SerBin<std::ios::out>& operator<<(SerBin<std::ios::out>& writer, const std::optional<T>& object)
+            size_t length = size_t(std::min(chunkSize, dataSize - index * chunkSize));
+            if (detail::readAt(handle, index * chunkSize, target, length) != length || detail::xxhash64(target, length) != leaves[size_t(index)])
+                return {};
+
+            return length;
+        }
+
+        // Verifies only the chunks overlapping [offset, offset + size). A thread
+        // count of 0 counts as 1.
+        bool verify(uint64_t offset, uint64_t size, unsigned threads = detail::defaultThreads()) const
+        {
+            if (!intact || offset > dataSize || size > dataSize - offset)
+                return false;
+            if (size == 0)
+                return true;
+
+            uint64_t first = offset / chunkSize;
+            uint64_t count = (offset + size - 1) / chunkSize - first + 1;
+            std::atomic<bool> ok = true;
+            std::vector<std::unique_ptr<char[]>> scratch(std::min<size_t>(std::max(threads, 1u), size_t(count)));
+
+            detail::parallelFor(scratch.size(), threads, [&](size_t t)
+            {
+                scratch[t] = std::make_unique<char[]>(size_t(chunkSize));
+                for (uint64_t i = t; i < count && ok; i += scratch.size())
+                {
+                    if (!readChunk(first + i, scratch[t].get()))
+                        ok = false;
+                }
+            });
+
+            return ok;
+        }
+
+        bool verify(unsigned threads = detail::defaultThreads()) const
+        {
+            return verify(0, dataSize, std::max(threads, 1u));
+        }
+    };
+
+    namespace detail
     {
-        bool hasValue = bool(object);
-        writer << hasValue;
+        // Get area is one whole chunk, loaded only after it matches its hash;
+        // a mismatch ends the stream
+        class VerifiedBuffer : public std::streambuf
+        {
+            const MerkleFile& file;
+            std::unique_ptr<char[]> buffer;
+            uint64_t next; // File offset just past the get area
 
-        if (hasValue)
-            writer << *object;
+        public:
+            VerifiedBuffer(const MerkleFile& file, uint64_t offset)
+                : file(file), buffer(std::make_unique<char[]>(size_t(std::max<uint64_t>(file.chunk(), 1)))), next(offset)
+            {
+            }
 
-        return writer;
+        protected:
+            int_type underflow() override
+            {
+                if (gptr() < egptr())
+                    return traits_type::to_int_type(*gptr());
+
+                if (next >= file.size())
+                    return traits_type::eof();
+
+                uint64_t index = next / file.chunk();
+                auto length = file.readChunk(index, buffer.get());
+                if (!length)
+                    return traits_type::eof();
+
+                size_t skip = size_t(next - index * file.chunk());
+                setg(buffer.get(), buffer.get() + skip, buffer.get() + *length);
+                next = index * file.chunk() + *length;
+                return traits_type::to_int_type(*gptr());
+            }
+
+            pos_type seekoff(off_type offset, std::ios::seekdir direction, std::ios::openmode which) override
+            {
+                off_type current = off_type(next) - (egptr() - gptr());
+                if (direction == std::ios::cur && offset == 0)
+                    return pos_type(current);
+
+                off_type base = direction == std::ios::beg ? 0 : direction == std::ios::end ? off_type(file.size()) : current;
+                return seekpos(pos_type(base + offset), which);
+            }
+
+            pos_type seekpos(pos_type position, std::ios::openmode which) override
+            {
+                if (!(which & std::ios::in) || off_type(position) < 0 || uint64_t(off_type(position)) > file.size())
+                    return pos_type(off_type(-1));
+
+                next = uint64_t(off_type(position));
+                setg(buffer.get(), buffer.get(), buffer.get());
+                return position;
+            }
+        };
     }
 
-    template<typename T>
-    inline SerBin<std::ios::in>& operator>>(SerBin<std::ios::in>& reader, std::optional<T>& object)
+    class MerkleFile::Cursor : private detail::VerifiedBuffer, public SerBin<std::ios::in>
     {
-        bool hasValue;
-        reader >> hasValue;
+    public:
+        explicit Cursor(const MerkleFile& file, uint64_t offset = 0)
+            : detail::VerifiedBuffer(file, offset), SerBin<std::ios::in>(static_cast<std::streambuf&>(*this))
+        {
+            if (!file.isIntact())
+                stream.setstate(std::ios::failbit);
+        }
 
-        if (hasValue)
+        void seek(uint64_t offset)
         {
-            object = T();
-            reader >> *object;
+            stream.clear();
+            stream.seekg(std::streamoff(offset));
         }
+    };
+}
 
-        return reader;
+// Replacement global allocator, so NoAllocationScope can see the heap. Define
+// SERBIN_INTERPOSE_ALLOCATOR before including this header in exactly one
+// translation unit of the program.
+#ifdef SERBIN_INTERPOSE_ALLOCATOR
+// Out of line, so GCC doesn't see malloc and free meet operator new and
+// delete after inlining and warn with -Wmismatched-new-delete
+#if defined(_MSC_VER)
+#define SERBIN_NOINLINE __declspec(noinline)
+#else
+#define SERBIN_NOINLINE __attribute__((noinline))
+#endif
+
+namespace serbin::detail
+{
+    SERBIN_NOINLINE inline void* interposedAllocate(size_t size, size_t alignment)
+    {
+        if (noAllocationDepth > 0)
+        {
+            ++hotPathAllocations;
+            assert(false && "heap allocation inside serbin::NoAllocationScope");
+        }
+
+        size = size > 0 ? size : 1;
+        void* memory;
+
+        if (alignment <= alignof(std::max_align_t))
+            memory = std::malloc(size);
+        else
+#if defined(_WIN32)
+            memory = _aligned_malloc(size, alignment);
+#else
+            memory = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+#endif
+
+        if (!memory)
+            throw std::bad_alloc();
+
+        return memory;
+    }
+
+    SERBIN_NOINLINE inline void interposedFree(void* memory, size_t alignment)
+    {
+#if defined(_WIN32)
+        if (alignment > alignof(std::max_align_t))
+        {
+            _aligned_free(memory);
+            return;
+        }
+#else
+        (void)alignment;
+#endif
+        std::free(memory);
     }
-}
\ No newline at end of file
+}
+
+void* operator new(size_t size)
+{
+    return serbin::detail::interposedAllocate(size, alignof(std::max_align_t));
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+    return serbin::detail::interposedAllocate(size, size_t(alignment));
+}
+
+void operator delete(void* memory) noexcept
+{
+    serbin::detail::interposedFree(memory, alignof(std::max_align_t));
+}
+
+void operator delete(void* memory, size_t) noexcept
+{
+    serbin::detail::interposedFree(memory, alignof(std::max_align_t));
+}
+
+void operator delete(void* memory, std::align_val_t alignment) noexcept
+{
+    serbin::detail::interposedFree(memory, size_t(alignment));
+}
+
+void operator delete(void* memory, size_t, std::align_val_t alignment) noexcept
+{
+    serbin::detail::interposedFree(memory, size_t(alignment));
+}
+#endif